@@ -0,0 +1,126 @@
+#include"he_crusk/he_crusk.hpp"
+
+#include"util/timer.hpp"
+
+/**
+ * 独自カーネル（符号反転，逆元，平文同士の加算・乗算，有理数スカラー倍）の
+ * スレッド数に対するスケーリングを計測する．
+ * また，rotate_and_sumを各stepの鍵のみで計算する場合と，連続する2つのstepの和の鍵も生成して
+ * rotate_many()でまとめて計算する場合とを比較する．
+ *
+ * usage: kernel n_trial poly_modulus_degree num_moduli [parallel_grain]
+ */
+int main(int argc, char* argv[]){
+  using Impl = he_wrapper_tmpl::ImplSeal<double>;
+
+  const size_t n_trial = std::stoi(argv[1]);
+  const size_t poly_modulus_degree = std::stoi(argv[2]);
+  const int num_moduli = std::stoi(argv[3]);
+  const size_t parallel_grain = (argc > 4 ? std::stoul(argv[4]) : size_t(1) << 16);
+  const double default_scale = std::pow(2.0, 40);
+
+  auto km = std::make_shared<Impl::KeyManager>();
+  km->poly_degree(poly_modulus_degree);
+  km->modulus_bits_list(std::vector<int>(num_moduli + 1, 50));
+  km->default_scale(default_scale);
+  km->parallel_grain(parallel_grain);
+  km->gen_params();
+  km->gen_sk();
+  km->gen_pk();
+
+  auto op = std::make_shared<Impl::Operator>(km);
+  const Impl::EncodingParams ep = op->get_initial_encoding_params();
+  Impl::EncodingParams scalar_ep = ep;
+  scalar_ep.set_scale(std::pow(2.0, 20));
+
+  std::mt19937_64 engine(std::random_device{}());
+  std::uniform_real_distribution<double> dist(0.5, 1.0);
+  auto gen_vec = [&](){
+    Impl::RawVec out(op->num_slots());
+    std::generate(out.begin(), out.end(), [&](){ return dist(engine); });
+    return out;
+  };
+
+  Impl::EncodedRationalScalar scalar;
+  op->encode(scalar, Impl::RawScalar(3.0), Impl::RawScalar(7.0), scalar_ep);
+
+  Impl::Plaintext pt1, pt2, pt_out;
+  Impl::Ciphertext ct, ct_out;
+  op->encode(pt1, gen_vec(), ep);
+  op->encode(pt2, gen_vec(), ep);
+  op->encode_and_encrypt(ct, gen_vec(), ep);
+
+  std::cout << "N = " << poly_modulus_degree << ", limbs = " << num_moduli
+            << ", parallel_grain = " << parallel_grain << std::endl;
+  std::cout << "threads, negate, invert, add (plain), mul (plain), mul (scalar), mul (encoded scalar) [us]" << std::endl;
+
+  const int max_threads = omp_get_max_threads();
+  for( int num_threads = 1; ; num_threads = std::min(num_threads * 2, max_threads) ){
+    omp_set_num_threads(num_threads);
+    util::TimerSet timer;
+
+    for( size_t i = 0; i < n_trial; ++i ){
+      timer.set("negate");
+      timer.emplace([&](){ op->negate(ct_out, ct); });
+
+      timer.set("invert");
+      timer.emplace([&](){ op->invert(pt_out, pt1); });
+
+      op->copy(pt_out, pt1);
+      timer.set("add (plain)");
+      timer.emplace([&](){ op->add(pt_out, pt2); });
+
+      op->copy(pt_out, pt1);
+      timer.set("mul (plain)");
+      timer.emplace([&](){ op->mul(pt_out, pt2); });
+
+      op->copy(ct_out, ct);
+      timer.set("mul (scalar)");
+      timer.emplace([&](){ op->mul(ct_out, 3.0, 7.0, scalar_ep); });
+
+      // エンコード済みのスカラーを再利用する場合
+      op->copy(ct_out, ct);
+      timer.set("mul (encoded scalar)");
+      timer.emplace([&](){ op->mul(ct_out, scalar); });
+    }
+
+    std::cout << num_threads;
+    for( const auto& name : timer.name() ){
+      std::cout << ", " << timer.get(name).get_average();
+    }
+    std::cout << std::endl;
+
+    if( num_threads == max_threads ){ break; }
+  }
+
+  std::vector<int> sum_steps;
+  for( int step = 1; sum_steps.size() < 8 && step < op->num_slots(); step *= 2 ){
+    sum_steps.push_back(step);
+  }
+  he_wrapper_tmpl::RotationPlanner planner(op->num_slots());
+  planner.add_rotate_and_sum(0, sum_steps, 1, true);
+  const auto plan = planner.plan(planner.weights().size() + planner.pair_weights().size());
+
+  std::cout << "rotate_and_sum (" << sum_steps.size() << " steps), keys, time [us]" << std::endl;
+  for( const bool hoisted : {false, true} ){
+    // 各stepの鍵のみ，もしくは組の和の鍵を含む計画の鍵を生成する
+    if( hoisted ){
+      km->rotate_steps(std::vector<int>{});
+      km->enable_glk(plan);
+    }else{
+      km->enable_glk(sum_steps);
+    }
+    km->gen_glk();
+
+    util::TimerSet timer;
+    timer.set("rotate_and_sum");
+    for( size_t i = 0; i < n_trial; ++i ){
+      timer.emplace([&](){ op->rotate_and_sum(ct_out, ct, 0, sum_steps); });
+    }
+    std::cout << (hoisted ? "hoisted pairs" : "single rotations") << ", "
+              << (hoisted ? plan.num_keys() : sum_steps.size()) << ", "
+              << timer.get("rotate_and_sum").get_average() << std::endl;
+  }
+
+  return 0;
+}
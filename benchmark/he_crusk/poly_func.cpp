@@ -130,36 +130,13 @@ private:
                               FuncExecWithHE&& func_exec_with_he,
                               FuncExecWithoutHE&& func_exec_without_he);
   
-  void exec_baseline(){
-    util::throw_not_implemented_error(__FILE__, __LINE__, __func__);
-  }
+  void exec_baseline();
 
 };
 
 
 template<int degree>
 void Executor<degree>::randomize(){
-  // 二項係数のメモ化
-  // degreeに依存するため，degreeごとに一度のみ生成するようにする．
-  static auto get_coeff = [&](const int j, const int i){
-    static std::vector<std::vector<double>> c = [](){
-      std::cout << "Generate for degree=" << degree << std::endl;
-      std::vector<std::vector<double>> c(degree+1);
-      for( int j = 1; j <= degree; ++j ){
-        const int n = j / 2;
-        c.at(j).resize(n + 1, 1.0);
-        for( int i = 1; i <= n; ++i ){
-          const int k = (i <= (j - 1) / 2 ? i : (j - 1) - i);
-          c.at(j).at(i) = c.at(j-1).at(i-1) + c.at(j-1).at(k);
-        }
-      }
-      return c;
-    }();
-
-    return (i <= j / 2 ? c.at(j).at(i) : c.at(j).at(j-i));
-  };
-
-  
   // 多項式関数の出力はランダム化されていないことを前提とする．
   std::transform(
       inputs.cbegin(), inputs.cend(), op_list.begin(), std::back_inserter(hcs),
@@ -169,52 +146,26 @@ void Executor<degree>::randomize(){
         
         timer.set("encrypt and randomize (variable)");
         timer.emplace([&](){
-          hc.add(he_crusk::RandomizedCiphertext("x", ep, 2, true, true),
+          // xのsub-keyはseedのみを保持し，必要な時に再生成する
+          hc.add(he_crusk::RandomizedCiphertext("x", ep, 2, true, true,
+                                                he_crusk::SubKeyStorage::seed_only),
                  input.vec.at(name2id.at("x")));
           hc.randomize(hc.get("x"));
         });
     
         timer.set("encrypt and randomize (constant)");
         timer.emplace([&](){
-          Impl::Plaintext tmp_pt;
-          Impl::Ciphertext tmp_ct;
-          std::vector<Impl::Ciphertext> tmp_ask(degree+1);
-          Impl::Plaintext inv_msk = hc.get("x").sbk.gen_inverted_mul_sbk(*op);
-
+          std::vector<he_crusk::RandomizedCiphertext<he_wrapper_tmpl::ImplSeal>> rcs;
+          std::vector<const Impl::RawVec*> msgs;
           for( size_t i = 0; i <= degree; ++i ){
             std::string name = varname(i);
-            hc.add(he_crusk::RandomizedCiphertext(name, ep, degree+2-i, false, false),
-                   input.vec.at(name2id.at(name)));
+            rcs.emplace_back(name, ep, degree+2-i, false, false);
+            msgs.emplace_back(&input.vec.at(name2id.at(name)));
           }
+          const auto coeffs = hc.add_batch(std::move(rcs), msgs);
 
-          // mul sub-keyの設定
-          for( int i = 1; i <= degree; ++i ){
-            op->template accumulate<Impl::Operator::OpType::mul>(tmp_pt, inv_msk);
-            op->copy(hc.get(varname(i)).sbk.mul_sbk(), tmp_pt);
-          }
-
-          // add sub-keyの設定およびランダム化
-          const Impl::Ciphertext ask = hc.get("x").sbk.add_sbk();
-          for( int i = degree; i >= 0; --i ){
-            auto& hcdata = hc.get(varname(i));
-            Impl::Ciphertext& target = hcdata.sbk.add_sbk();
-
-            for( int j = i + 1; j <= degree; ++j ){
-              op->copy(tmp_ct, ask);
-              const auto ep = Impl::EncodingParams(tmp_ct).set_scale(1.0);
-              // 前回イテレーション時にかけた二項係数の値の逆元もかけて補正する
-              op->mul(tmp_ct, get_coeff(j, i), get_coeff(j, i + 1), ep);
-              op->mul(tmp_ask.at(j), tmp_ct);
-
-              op->template accumulate<Impl::Operator::OpType::add>(target, tmp_ask.at(j));
-            }
-            if( target.ptr() != nullptr ){            
-              op->negate(target, target);
-            }
-        
-            hc.randomize(hcdata);
-            op->copy(tmp_ask.at(i), hcdata.randomized);
-          }
+          // sub-keyの設定およびランダム化
+          hc.prepare_polynomial(coeffs, hc.handle("x"));
         });
     
         return hc;
@@ -231,14 +182,15 @@ void Executor<degree>::exec(){
 
   for( size_t i = 0; i < n_trial; ++i ){
     auto& hc = hcs.at(i);
-    const auto& op = hc.op();
+    // 変数名の検索は計測の対象外とし，ハンドルを介してアクセスする
+    const auto x = hc.handle("x");
+    std::vector<he_crusk::VariableHandle> a;
+    for( int j = 0; j <= degree; ++j ){
+      a.emplace_back(hc.handle(varname(j)));
+    }
     timer.emplace();
     timer.add();
-    op.copy(results.at(i), hc.get(varname(degree)).randomized);
-    for( size_t j = degree; j > 0; --j ){
-      op.mul(results.at(i), hc.get("x").randomized);
-      op.add(results.at(i), hc.get(varname(j-1)).randomized);
-    }
+    hc.evaluate_polynomial(results.at(i), a, x);
     timer.add();
   }
 
@@ -279,13 +231,11 @@ void Executor<degree>::exec_baseline_template(FuncCalcEp&& func_calc_ep,
   const size_t n = name2id.size();
   
   std::vector<Impl::EncodingParams> ep(n, op_list.at(0)->get_initial_encoding_params());
+  // 各暗号文のエンコードパラメータはHE演算を行わずに求める
   func_calc_ep(
       [&](const std::string& name) -> auto& {
         return ep.at(name2id.at(name));
       },
-      [&](const std::string& name) -> auto& {
-        return inputs.at(0).vec.at(name2id.at(name));
-      },
       op_list.at(0)
   );
   
@@ -324,23 +274,62 @@ void Executor<degree>::exec_baseline_template(FuncCalcEp&& func_calc_ep,
 }
 
 
+/**
+ * 実行（ベースライン）
+ * 次数2，3，7以外はPolynomialEvaluatorによるbaby-step giant-stepで評価する．
+ */
+template<int degree>
+void Executor<degree>::exec_baseline(){
+  he_wrapper_tmpl::PolynomialEvaluator<he_wrapper_tmpl::ImplSeal> evaluator(degree);
+
+  auto calc_encoding_params = [&](auto&& ep,
+                                  const auto& op){
+    const auto& coeff_eps = evaluator.plan(*op, ep("x"));
+    for( int i = 0; i <= degree; ++i ){
+      ep(varname(i)) = coeff_eps.at(i);
+    }
+  };
+
+  auto exec_with_he = [&](Impl::Ciphertext& out,
+                          auto&& cts,
+                          const auto& op){
+    std::vector<Impl::Ciphertext> coeffs;
+    std::vector<const Impl::Ciphertext*> ptrs;
+    coeffs.reserve(degree+1);
+    for( int i = 0; i <= degree; ++i ){
+      ptrs.emplace_back(&coeffs.emplace_back(cts(varname(i))));
+    }
+    // 計算量の観点から，最後の積のrelinearizationとrescalingは行わない
+    evaluator.evaluate(*op, out, cts("x"), ptrs);
+  };
+
+  auto exec_without_he = [&](auto& out, auto&& in){
+    out = in(varname(degree));
+    for( int i = degree; i > 0; --i ){
+      out *= in("x");
+      out += in(varname(i-1));
+    }
+  };
+
+  exec_baseline_template(calc_encoding_params,
+                         exec_with_he,
+                         exec_without_he);
+}
+
+
 
 template<>
 void Executor<2>::exec_baseline(){
   auto calc_encoding_params = [&](auto&& ep,
-                                  auto&& input,
                                   const auto& op){
-    Impl::Ciphertext tmp, tmp2;
-    op->encode_and_encrypt(tmp, input("x"), ep("x"));
-    ep("x").configure(tmp);
-    ep("a1").configure(tmp);
+    Impl::EncodingParams tmp = ep("x");
+    ep("a1") = tmp;
     op->square(tmp);
-    op->relinearize(tmp);
     op->rescale(tmp);
-    ep("a2").configure(tmp).set_scale(ep("x").scale);
-    op->encode_and_encrypt(tmp2, input("a2"), ep("a2"));
-    op->mul(tmp, tmp2);
-    ep("a0").configure(tmp);
+    ep("a2") = tmp;
+    ep("a2").set_scale(ep("x").scale);
+    op->mul(tmp, ep("a2"));
+    ep("a0") = tmp;
   };
   
   auto exec_with_he = [&](Impl::Ciphertext& out,
@@ -370,59 +359,52 @@ void Executor<2>::exec_baseline(){
 template<>
 void Executor<3>::exec_baseline(){
   auto calc_encoding_params = [&](auto&& ep,
-                                  auto&& input,
                                   const auto& op){
-    Impl::Ciphertext tmp, x, a3, a2, x2, a1, a1x, a0;
-    op->encode_and_encrypt(x, input("x"), ep("x"));
-    ep("x").configure(x);
-    ep("a3").configure(x);
-    op->encode_and_encrypt(a3, input("a3"), ep("a3"));
-    op->mul(tmp, a3, x);
-    op->relinearize(tmp);
+    Impl::EncodingParams tmp, x, x2, a1x;
+    x = ep("x");
+    ep("a3") = x;
+    tmp = x;
+    op->mul(tmp, ep("a3"));
     op->rescale(tmp);
-    ep("a2").configure(tmp);
+    ep("a2") = tmp;
     
-    op->encode_and_encrypt(a2, input("a2"), ep("a2"));
-    op->add(tmp, a2);
-    
-    op->square(x2, x);
-    op->relinearize(x2);
+    x2 = x;
+    op->square(x2);
     op->rescale(x2);
 
     op->mul(tmp, x2);
 
-    ep("a1").configure(x2).set_scale(tmp.scale() / ep("x").scale);
-    op->encode_and_encrypt(a1, input("a1"), ep("a1"));
+    ep("a1") = x2;
+    ep("a1").set_scale(tmp.scale / ep("x").scale);
     op->mod_down(x, 1);
-    op->mul(a1x, a1, x);
+    a1x = ep("a1");
+    op->mul(a1x, x);
     op->add(tmp, a1x);
-    op->relinearize(tmp);
     op->rescale(tmp);
     
-    ep("a0").configure(tmp);
-    op->encode_and_encrypt(a0, input("a0"), ep("a0"));
-    op->add(tmp, a0);
+    ep("a0") = tmp;
   };
   
   auto exec_with_he = [&](Impl::Ciphertext& out,
                           auto&& cts,
                           const auto& op){
-    Impl::Ciphertext tmp;
+    // 一時的な暗号文はプールから借り，同じOperatorで繰り返し評価する場合は領域を再利用する
+    auto tmp = op->lease_ciphertext(cts("x").level());
     
     op->mul(out, cts("a3"), cts("x"));
     op->relinearize(out);
     op->rescale(out);
     op->add(out, cts("a2"));
 
-    op->square(tmp, cts("x"));
-    op->relinearize(tmp);
-    op->rescale(tmp);
+    op->square(*tmp, cts("x"));
+    op->relinearize(*tmp);
+    op->rescale(*tmp);
 
-    op->mul(out, tmp);
+    op->mul(out, *tmp);
 
-    op->mod_down(tmp, cts("x"), 1);
-    op->mul(tmp, cts("a1"));
-    op->add(out, tmp);
+    op->mod_down(*tmp, cts("x"), 1);
+    op->mul(*tmp, cts("a1"));
+    op->add(out, *tmp);
     op->relinearize(out);
     op->rescale(out);
 
@@ -442,110 +424,101 @@ void Executor<3>::exec_baseline(){
 template<>
 void Executor<7>::exec_baseline(){
   auto calc_encoding_params = [&](auto&& ep,
-                                  auto&& input,
                                   const auto& op){
-    Impl::Ciphertext tmp, tmp2, x, x2, x4, a7, a6, a5, a4, a3, a2, a1, a0, a7x, a3x;
-    op->encode_and_encrypt(x, input("x"), ep("x"));
-    ep("x").configure(x);
-    ep("a7").configure(x);
-    op->encode_and_encrypt(a7, input("a7"), ep("a7"));
-    op->mul(a7x, x, a7);
-    op->relinearize(a7x);
+    Impl::EncodingParams tmp, x, x2, x4, a7x, a3x, rescaled_x;
+    x = ep("x");
+    ep("a7") = x;
+    a7x = x;
+    op->mul(a7x, ep("a7"));
     op->rescale(a7x);
 
-    ep("a6").configure(a7x);
-    op->encode_and_encrypt(a6, input("a6"), ep("a6"));
-    op->add(a7x, a6);
+    ep("a6") = a7x;
     
-    op->square(x2, x);
-    op->relinearize(x2);
+    x2 = x;
+    op->square(x2);
     op->rescale(x2);
 
-    op->square(x4, x2);
-    op->relinearize(x4);
+    x4 = x2;
+    op->square(x4);
     op->rescale(x4);
 
-    ep("a5").configure(x2);
-    op->encode_and_encrypt(a5, input("a5"), ep("a5"));
-    op->add(tmp, x2, a5);
+    ep("a5") = x2;
+    tmp = x2;
 
     op->mul(tmp, a7x);
-    op->relinearize(tmp);
     op->rescale(tmp);
 
-    ep("a4").configure(tmp);
-    op->encode_and_encrypt(a4, input("a4"), ep("a4"));
-    op->add(tmp, a4);
+    ep("a4") = tmp;
 
     op->mul(tmp, x4);
 
     
     op->mod_down(x2, 1);
-    ep("a1").configure(x2);
-    op->encode_and_encrypt(a1, input("a1"), ep("a1"));
-    op->add(x2, a1);
+    ep("a1") = x2;
     
     op->mod_down(x, 1);
-    op->rescale(tmp2, x);
-    ep("a3").configure(x).set_scale(tmp.scale() / x2.scale() / tmp2.scale());
-    op->encode_and_encrypt(a3, input("a3"), ep("a3"));
-    op->mul(a3x, x, a3);
-    op->relinearize(a3x);
+    rescaled_x = x;
+    op->rescale(rescaled_x);
+    ep("a3") = x;
+    ep("a3").set_scale(tmp.scale / x2.scale / rescaled_x.scale);
+    a3x = x;
+    op->mul(a3x, ep("a3"));
     op->rescale(a3x);
-    ep("a2").configure(a3x);
-    op->encode_and_encrypt(a2, input("a2"), ep("a2"));
-    op->add(a3x, a2);
+    ep("a2") = a3x;
 
     op->mul(a3x, x2);
 
     op->add(tmp, a3x);
-    ep("a0").configure(tmp);
-    op->encode_and_encrypt(a0, input("a0"), ep("a0"));
-    op->add(tmp, a0);
+    ep("a0") = tmp;
     
   };
   
   auto exec_with_he = [&](Impl::Ciphertext& out,
                           auto&& cts,
                           const auto& op){
-    Impl::Ciphertext x2, x4, a7x, a3x;
-    op->mul(a7x, cts("x"), cts("a7"));
-    op->relinearize(a7x);
-    op->rescale(a7x);
-
-    op->add(a7x, cts("a6"));
+    // 一時的な暗号文はプールから借り，同じOperatorで繰り返し評価する場合は領域を再利用する
+    const int level = cts("x").level();
+    auto x2 = op->lease_ciphertext(level);
+    auto x4 = op->lease_ciphertext(level);
+    auto a7x = op->lease_ciphertext(level);
+    auto a3x = op->lease_ciphertext(level);
+    op->mul(*a7x, cts("x"), cts("a7"));
+    op->relinearize(*a7x);
+    op->rescale(*a7x);
+
+    op->add(*a7x, cts("a6"));
     
-    op->square(x2, cts("x"));
-    op->relinearize(x2);
-    op->rescale(x2);
+    op->square(*x2, cts("x"));
+    op->relinearize(*x2);
+    op->rescale(*x2);
 
-    op->square(x4, x2);
-    op->relinearize(x4);
-    op->rescale(x4);
+    op->square(*x4, *x2);
+    op->relinearize(*x4);
+    op->rescale(*x4);
 
-    op->add(out, x2, cts("a5"));
+    op->add(out, *x2, cts("a5"));
 
-    op->mul(out, a7x);
+    op->mul(out, *a7x);
     op->relinearize(out);
     op->rescale(out);
 
     op->add(out, cts("a4"));
 
-    op->mul(out, x4);
+    op->mul(out, *x4);
 
     
-    op->mod_down(x2, 1);
-    op->add(x2, cts("a1"));
+    op->mod_down(*x2, 1);
+    op->add(*x2, cts("a1"));
     
-    op->mod_down(a3x, cts("x"), 1);
-    op->mul(a3x, cts("a3"));
-    op->relinearize(a3x);
-    op->rescale(a3x);
-    op->add(a3x, cts("a2"));
+    op->mod_down(*a3x, cts("x"), 1);
+    op->mul(*a3x, cts("a3"));
+    op->relinearize(*a3x);
+    op->rescale(*a3x);
+    op->add(*a3x, cts("a2"));
 
-    op->mul(a3x, x2);
+    op->mul(*a3x, *x2);
 
-    op->add(out, a3x);
+    op->add(out, *a3x);
     op->add(out, cts("a0"));
   };
 
@@ -611,6 +584,24 @@ Executor<degree>& Executor<degree>::run(){
 }
 
 
+/// HE-CRUSKはmax_degreeまでの任意の次数を実行できる（ベースラインは実装済みの次数のみ）
+constexpr int max_degree = 31;
+
+/// ds = 0, ..., max_degree-1のそれぞれに次数ds+1を割り当て，一致したExecutorを実行する
+template<int... ds>
+void dispatch_degree(std::integer_sequence<int, ds...>, const size_t degree,
+                     std::vector<std::shared_ptr<Impl::Operator>>&& op_list,
+                     const size_t n_trial, const std::string& mode){
+  const bool found = (
+      (static_cast<int>(degree) == ds + 1
+       && (Executor<ds + 1>(std::move(op_list), n_trial, mode).run().print_timer(), true)) || ...
+  );
+  if( !found ){
+    util::throw_not_implemented_error(__FILE__, __LINE__, __func__);
+  }
+}
+
+
 int main(int argc, char* argv[]){
   const size_t n_trial = std::stoi(argv[1]);
   const size_t degree = std::stoi(argv[2]);
@@ -621,6 +612,11 @@ int main(int argc, char* argv[]){
   const double default_scale = std::pow(2.0, default_scale_bit);
   const size_t modulus_bit = std::stoi(argv[6]);
   const int num_moduli = std::stoi(argv[7]);
+  // 鍵の保存先（指定した場合，trialごとの鍵を保存し，2回目以降の実行では読み込む）
+  const std::string key_dir = (argc > 8 ? argv[8] : "");
+  const auto key_format = (argc > 9 && std::string(argv[9]) == "expanded"
+                           ? Impl::KeyManager::KeyFormat::expanded
+                           : Impl::KeyManager::KeyFormat::seeded);
 
   const std::vector<int> moduli_bits = [&](){
     std::vector<int> out(num_moduli+1, modulus_bit);
@@ -629,16 +625,27 @@ int main(int argc, char* argv[]){
     return out;
   }();
 
+  size_t key_set_id = 0;
   auto gen_op = [&](){
     auto km = std::make_shared<Impl::KeyManager>();
     km->poly_degree(poly_modulus_degree);
     km->modulus_bits_list(moduli_bits);
     km->default_scale(default_scale);
     km->gen_params();
-    km->gen_sk();
-    km->gen_pk();
+    km->enable_sk().enable_pk();
     if( mode == "baseline" || mode == "both" ){
-      km->gen_rlk();
+      km->enable_rlk();
+    }
+    if( key_dir.empty() ){
+      km->gen_keys();
+    }else{
+      km->key_dir(key_dir + "/" + std::to_string(key_set_id++)).key_format(key_format);
+      if( km->has_saved_keys() ){
+        km->load_keys();
+      }else{
+        km->gen_keys();
+        km->save_keys();
+      }
     }
     
     auto op = std::make_shared<Impl::Operator>(km);
@@ -650,31 +657,8 @@ int main(int argc, char* argv[]){
   // 全体で共通の鍵を使う場合
   // std::fill_n(std::back_inserter(op_list), n_trial, gen_op);
 
-  switch( degree ){
-    case 2:
-      Executor<2>(std::move(op_list), n_trial, mode)
-        .run()
-        .print_timer();
-      break;
-    case 3:
-      {
-        Executor<3> e(std::move(op_list), n_trial, mode);
-        e.run();
-        e.print_timer();
-        break;
-      }
-    case 7:
-      {
-        Executor<7> e(std::move(op_list), n_trial, mode);
-        e.run();
-        e.print_timer();
-        break;
-      }
-
-    default:
-      util::throw_not_implemented_error(__FILE__, __LINE__, __func__);
-      break;
-  }
+  dispatch_degree(std::make_integer_sequence<int, max_degree>(), degree,
+                  std::move(op_list), n_trial, mode);
 
   
   return 0;
@@ -1,3 +1,5 @@
+#include<omp.h>
+
 #include"he_crusk/he_crusk.hpp"
 
 int main(){
@@ -62,7 +64,53 @@ int main(){
 
   std::cout << result << std::endl;
   std::cout << gt << std::endl;
+
+  bool passed = true;
+
+  // sub-keyの乱数多項式がスレッド数によらず同じseedから同じになることを確認する
+  {
+    const size_t n = poly_modulus_degree;
+    std::vector<uint64_t> moduli(moduli_bits.size() - 1);
+    for( size_t i = 0; i < moduli.size(); ++i ){
+      moduli.at(i) = km->get_modulus(i);
+    }
+    const int max_threads = omp_get_max_threads();
+    const he_crusk::SubKeyGenerator generator(340);
+    std::vector<uint64_t> single(n * moduli.size()), multi(n * moduli.size());
+    omp_set_num_threads(1);
+    generator.generate(single.data(), n, moduli, 1, 0);
+    omp_set_num_threads(max_threads);
+    generator.generate(multi.data(), n, moduli, 1, 0);
+
+    const bool same = (single == multi);
+    std::cout << "sub-key generation (1 vs " << max_threads << " threads): "
+              << (same ? "OK" : "NG") << std::endl;
+    passed &= same;
+  }
+
+  // gen_inverted_mul_sbk()とmul_sbkの積が各limbの全係数で1となることを確認する
+  {
+    const auto& x_sbk = std::as_const(hc.get("x").sbk);
+    const Impl::Plaintext inverted = x_sbk.gen_inverted_mul_sbk(*op);
+    const Impl::Plaintext& mul_sbk = x_sbk.mul_sbk();
+    const size_t n = poly_modulus_degree;
+
+    bool is_one = (inverted.num_moduli() == mul_sbk.num_moduli());
+    for( int i = 0; is_one && i < mul_sbk.num_moduli(); ++i ){
+      const seal::Modulus modulus(km->get_modulus(i));
+      const uint64_t* a = inverted.data() + i * n;
+      const uint64_t* b = mul_sbk.data() + i * n;
+      for( size_t j = 0; j < n; ++j ){
+        if( seal::util::multiply_uint_mod(a[j], b[j], modulus) != 1 ){
+          is_one = false;
+          break;
+        }
+      }
+    }
+    std::cout << "inverted mul sub-key: " << (is_one ? "OK" : "NG") << std::endl;
+    passed &= is_one;
+  }
   
-  return 0;
+  return (passed ? 0 : 1);
 }
 
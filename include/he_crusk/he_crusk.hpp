@@ -2,14 +2,45 @@
 
 #include"he_crusk/randomized_ciphertext.hpp"
 #include"he_crusk/sub_key.hpp"
+#include"he_crusk/sub_key_pool.hpp"
 
 namespace he_crusk{
+/// HeCruskに登録した変数を指すハンドル（add()が返す）
+struct VariableHandle{
+  size_t id;
+
+  bool operator==(const VariableHandle&) const = default;
+};
+
+
 template<template<class> class Impl>
 class HeCrusk{
 public:
+  using EncodingParams = he_wrapper_tmpl::EncodingParams<Impl>;
   using Operator = he_wrapper_tmpl::Operator<Impl>;
   using Plaintext = he_wrapper_tmpl::Plaintext<Impl>;
   using Ciphertext = he_wrapper_tmpl::Ciphertext<Impl>;
+  using Handle = VariableHandle;
+
+  /**
+   * 変数を構成する各要素への参照
+   * （各要素は要素ごとの配列に格納しているため，add()により無効になる）
+   */
+  template<bool is_const>
+  struct VariableRef{
+    template<class T>
+    using Ref = std::conditional_t<is_const, const T&, T&>;
+
+    const std::string& name;
+    const EncodingParams& ep;
+    const size_t& size;
+    Ref<Plaintext> pt;
+    Ref<Ciphertext> original;
+    Ref<Ciphertext> randomized;
+    Ref<SubKey<Impl>> sbk;
+  };
+  using Variable = VariableRef<false>;
+  using ConstVariable = VariableRef<true>;
 
   HeCrusk(std::shared_ptr<Operator> op) : op_(op){}
   ~HeCrusk() = default;
@@ -18,60 +49,235 @@ public:
   
   auto& op(){ return *op_; }
   const auto& op() const { return *op_; }
+  size_t num_variables() const noexcept { return names_.size(); }
   const auto& name2id(const std::string& name) const { return name2id_.at(name); }
-  auto& get(const std::string& name){ return data_.at(name2id(name)); }
-  const auto& get(const std::string& name) const { return data_.at(name2id(name)); }
+  Handle handle(const std::string& name) const { return Handle{name2id(name)}; }
+
+  Variable get(const Handle h){
+    return {names_[h.id], eps_[h.id], sizes_[h.id], pts_[h.id],
+            originals_[h.id], randomized_[h.id], sbks_[h.id]};
+  }
+  ConstVariable get(const Handle h) const {
+    return {names_[h.id], eps_[h.id], sizes_[h.id], pts_[h.id],
+            originals_[h.id], randomized_[h.id], sbks_[h.id]};
+  }
+  Variable get(const std::string& name){ return get(handle(name)); }
+  ConstVariable get(const std::string& name) const { return get(handle(name)); }
+
+  /// ハンドルによる各要素へのアクセス（名前の検索を伴わない）
+  const auto& name(const Handle h) const noexcept { return names_[h.id]; }
+  auto& original(const Handle h) noexcept { return originals_[h.id]; }
+  const auto& original(const Handle h) const noexcept { return originals_[h.id]; }
+  auto& randomized(const Handle h) noexcept { return randomized_[h.id]; }
+  const auto& randomized(const Handle h) const noexcept { return randomized_[h.id]; }
+  auto& sbk(const Handle h) noexcept { return sbks_[h.id]; }
+  const auto& sbk(const Handle h) const noexcept { return sbks_[h.id]; }
+
+  /// sub-keyを事前生成したプールから取り出すようにする（nullptrの場合は常にその場で生成する）
+  void set_sub_key_pool(std::shared_ptr<SubKeyPool<Impl>> pool){ sub_key_pool_ = pool; }
+  const auto& sub_key_pool() const { return sub_key_pool_; }
   
 
   template<class MsgType>
-  void add(RandomizedCiphertext<Impl>&& rc,
-           const he_wrapper_tmpl::RawVec<MsgType>& msg){
-    auto& x = data_.emplace_back(std::move(rc));
-    name2id_[x.name] = data_.size() - 1;
-
-    op().encode(x.pt, msg, x.ep);
-    encrypt(x);
-    
-    x.sbk.generate(x.original, *op_);
-    
+  Handle add(RandomizedCiphertext<Impl>&& rc,
+             const he_wrapper_tmpl::RawVec<MsgType>& msg){
+    const Handle h = register_variable(std::move(rc));
+    prepare_variable(h, msg);
+    return h;
+  }
+
+  /**
+   * 複数の変数を並列に追加する．
+   * 変数の登録（ハンドルの割り当て）はrcsの順に逐次的に行うため，結果はadd()を順に呼んだ場合と同じとなる．
+   */
+  template<class MsgType>
+  std::vector<Handle> add_batch(std::vector<RandomizedCiphertext<Impl>>&& rcs,
+                                const std::vector<const he_wrapper_tmpl::RawVec<MsgType>*>& msgs){
+    if( rcs.size() != msgs.size() ){
+      throw std::invalid_argument("rcs and msgs size mismatch");
+    }
+    std::vector<Handle> hs;
+    for( auto& rc : rcs ){
+      hs.emplace_back(register_variable(std::move(rc)));
+    }
+    // 各スレッドは共有のEncryptorを用いる（暗号化は内部状態を持たない）．
+    // 作業領域にはスレッドローカルなメモリプールを用いる（KeyManager::pool()）．
+#pragma omp parallel for schedule(dynamic)
+    for( size_t i = 0; i < hs.size(); ++i ){
+      prepare_variable(hs[i], *msgs[i]);
+    }
+    return hs;
+  }
+
+  void randomize(const Handle h){
+    sbks_[h.id].randomize(randomized_[h.id], originals_[h.id], op());
+  }
+
+  void randomize(const Variable& v){
+    v.sbk.randomize(v.randomized, v.original, op());
+  }
+
+  /**
+   * ランダム化した暗号文により，sum_i coeffs[i] x^iをHorner法で評価する（次数は任意）．
+   *
+   * 結果の暗号文は各ステップで成分数が1つずつ増えるため，最終的な成分数の容量を
+   * 最初に一度だけ確保し，以降の各ステップは再確保を伴わずにその場で計算する．
+   */
+  void evaluate_polynomial(Ciphertext& out, const std::vector<Handle>& coeffs, const Handle x) const {
+    if( coeffs.empty() ){
+      throw std::invalid_argument("coeffs must not be empty");
+    }
+    const size_t degree = coeffs.size() - 1;
+    const auto& rx = randomized(x);
+    const auto& leading = randomized(coeffs.back());
+    size_t size = leading.size();
+    for( size_t j = degree; j > 0; --j ){
+      size = std::max(size + rx.size() - 1, randomized(coeffs[j-1]).size());
+    }
+
+    op().reserve(out, EncodingParams(leading), size);
+    op().copy(out, leading);
+    for( size_t j = degree; j > 0; --j ){
+      if( rx.size() == 2 ){
+        op().mul_add(out, rx, randomized(coeffs[j-1]));
+      }else{
+        op().mul(out, rx);
+        op().add(out, randomized(coeffs[j-1]));
+      }
+    }
+  }
+
+  void prepare_polynomial(const std::vector<std::string>& coeffs, const std::string& x){
+    std::vector<Handle> hs;
+    std::transform(coeffs.cbegin(), coeffs.cend(), std::back_inserter(hs),
+                   [&](const auto& name){ return handle(name); });
+    prepare_polynomial(hs, handle(x));
   }
 
-  void randomize(RandomizedCiphertext<Impl>& rc){
-    rc.sbk.randomize(rc.randomized, rc.original, op());
+  /**
+   * 多項式sum_i coeffs[i] x^iの係数を，ランダム化したxに合わせてランダム化する．
+   *
+   * xのsub-keyによりx' = r x + aとしたとき，係数iのmul sub-keyをr^{-i}とし，
+   * E_i = coeffs[i] r^{-i}を係数とする多項式E(y)をE(y - a)に平行移動した係数を
+   * ランダム化した暗号文とする（add sub-keyはその差分）．これにより
+   * sum_i coeffs'[i] x'^i = sum_i coeffs[i] x^iとなる．
+   *
+   * 各係数はsub-keyを自動生成せずにadd()しておく．係数iのscaling factorは，
+   * 係数i+1とxのscaling factorの積に一致している必要がある．xのランダム化はrandomize()で別途行う．
+   */
+  void prepare_polynomial(const std::vector<Handle>& coeffs, const Handle x){
+    const auto& x_sbk = sbk(x);
+    const int degree = static_cast<int>(coeffs.size()) - 1;
+
+    // mul sub-keyの設定（r^{-1}の冪を各係数のmul sub-keyに直接書き込む）
+    if( x_sbk.has_mul_sbk() && degree >= 1 ){
+      const Plaintext inv_msk = x_sbk.gen_inverted_mul_sbk(op());
+      std::vector<Plaintext*> inv_msk_powers;
+      for( int i = 1; i <= degree; ++i ){
+        inv_msk_powers.emplace_back(&sbk(coeffs.at(i)).mul_sbk());
+      }
+      op().template scan<Operator::OpType::mul>(
+          inv_msk_powers, std::vector<const Plaintext*>(degree, &inv_msk)
+      );
+    }
+
+#pragma omp parallel for
+    for( int i = 0; i <= degree; ++i ){
+      const Handle h = coeffs.at(i);
+      if( sbk(h).mul_sbk().ptr() != nullptr ){
+        op().mul(randomized(h), original(h), sbk(h).mul_sbk());
+      }else{
+        op().copy(randomized(h), original(h));
+      }
+    }
+
+    if( !x_sbk.has_add_sbk() ){
+      return;
+    }
+
+    // add sub-keyの設定（E(y - a)の係数との差分とする．最高次の係数は変化しない）
+#pragma omp parallel for
+    for( int i = 0; i < degree; ++i ){
+      op().negate(sbk(coeffs.at(i)).add_sbk(), randomized(coeffs.at(i)));
+    }
+
+    std::vector<Ciphertext*> shifted;
+    for( const Handle h : coeffs ){
+      shifted.emplace_back(&randomized(h));
+    }
+    op().taylor_shift(shifted, x_sbk.gen_negated_add_sbk(op()));
+
+#pragma omp parallel for
+    for( int i = 0; i < degree; ++i ){
+      op().add(sbk(coeffs.at(i)).add_sbk(), randomized(coeffs.at(i)));
+    }
   }
   
 private:
-  void encrypt(RandomizedCiphertext<Impl>& rc){
+  Handle register_variable(RandomizedCiphertext<Impl>&& rc){
     if( rc.size < 2){
       throw std::invalid_argument("Invalid target ciphertext size.");
     }
+    const Handle h{names_.size()};
+    name2id_[rc.name] = h.id;
+    names_.emplace_back(std::move(rc.name));
+    eps_.emplace_back(rc.ep);
+    sizes_.emplace_back(rc.size);
+    pts_.emplace_back(std::move(rc.pt));
+    originals_.emplace_back(std::move(rc.original));
+    randomized_.emplace_back(std::move(rc.randomized));
+    sbks_.emplace_back(std::move(rc.sbk));
+    return h;
+  }
 
-    op().encrypt(rc.original, rc.pt);
-
-    if( rc.size == rc.original.size() ){
-      return;
+  /// エンコード，暗号化およびsub-keyの生成（変数ごとに独立に実行できる）
+  template<class MsgType>
+  void prepare_variable(const Handle h, const he_wrapper_tmpl::RawVec<MsgType>& msg){
+    // サイズを拡張しても復号結果のscaling factorが揃うよう，ep.scale^(size-1)でエンコードする
+    EncodingParams ep = eps_[h.id];
+    for( size_t i = 2; i < sizes_[h.id]; ++i ){
+      ep.scale *= eps_[h.id].scale;
     }
-    
-    he_wrapper_tmpl::EncodingParams<Impl> ep;
-    ep.configure(rc.original);
-    Ciphertext encrypted_one;
-    he_wrapper_tmpl::RawVec<double> one(std::vector<double>(op().num_slots(), 1.0));
-    Plaintext encoded_one;
-    op().encode(encoded_one, one, ep);
-    while( rc.original.size() < rc.size ){
-      op().encrypt(encrypted_one, encoded_one);
-      op().mul(rc.original, encrypted_one);
+    op().encode(pts_[h.id], msg, ep);
+    op().encrypt(originals_[h.id], pts_[h.id], sizes_[h.id]);
+
+    if( !acquire_sub_key(sbks_[h.id], originals_[h.id]) ){
+      sbks_[h.id].generate(originals_[h.id], *op_);
     }
+  }
 
+  /// プールに事前生成されたsub-keyがあれば，それをsbkとする
+  bool acquire_sub_key(SubKey<Impl>& sbk, const Ciphertext& original){
+    if( sub_key_pool_ == nullptr || !sbk.is_data_independent() ){
+      return false;
+    }
+    const bool autogen_mul_sbk = sbk.autogen_mul_sbk();
+    const bool autogen_add_sbk = sbk.autogen_add_sbk();
+    if( !autogen_mul_sbk && !autogen_add_sbk ){
+      return false;
+    }
+    auto acquired = sub_key_pool_->acquire(original, autogen_mul_sbk, autogen_add_sbk);
+    if( !acquired ){
+      return false;
+    }
+    sbk = std::move(*acquired);
+    return true;
   }
 
   std::shared_ptr<Operator> op_;
 
-  std::unordered_map<std::string, int> name2id_;
-  
-  std::vector<RandomizedCiphertext<Impl>> data_;
-  
-  
+  std::shared_ptr<SubKeyPool<Impl>> sub_key_pool_;
+
+  std::unordered_map<std::string, size_t> name2id_;
+
+  // 変数の各要素は要素ごとに連続した配列に格納する（structure of arrays）
+  std::vector<std::string> names_;
+  std::vector<EncodingParams> eps_;
+  std::vector<size_t> sizes_;
+  std::vector<Plaintext> pts_;
+  std::vector<Ciphertext> originals_;
+  std::vector<Ciphertext> randomized_;
+  std::vector<SubKey<Impl>> sbks_;
 
 };
 
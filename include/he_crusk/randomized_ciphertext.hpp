@@ -9,10 +9,12 @@ struct RandomizedCiphertext{
   using Plaintext = he_wrapper_tmpl::Plaintext<Impl>;
   using Ciphertext = he_wrapper_tmpl::Ciphertext<Impl>;
 
+  /// @param storage 自動生成するsub-keyの保持方法（SubKey参照）
   RandomizedCiphertext(const std::string& name, const EncodingParams& ep, const size_t size,
-                       const bool autogen_mul_sbk, const bool autogen_add_sbk)
+                       const bool autogen_mul_sbk, const bool autogen_add_sbk,
+                       const SubKeyStorage storage=SubKeyStorage::expanded)
     : name(name), ep(ep), size(size),
-      sbk(autogen_mul_sbk, autogen_add_sbk){}
+      sbk(autogen_mul_sbk, autogen_add_sbk, storage){}
   ~RandomizedCiphertext() = default;
   RandomizedCiphertext(const RandomizedCiphertext&) = default;
   RandomizedCiphertext(RandomizedCiphertext&&) noexcept = default;
@@ -2,7 +2,15 @@
 
 #include"he_wrapper_tmpl/he_wrapper_tmpl.hpp"
 
+#include"he_crusk/sub_key_generator.hpp"
+
 namespace he_crusk{
+/// 自動生成するsub-keyの保持方法
+enum class SubKeyStorage : int {
+  expanded,   ///< 生成した乱数多項式を保持する
+  seed_only,  ///< seedのみを保持し，必要な時に再生成する
+};
+
 template<template<class> class Impl>
 class SubKey{
 public:
@@ -14,33 +22,131 @@ public:
   SubKey(){}
   SubKey(const bool autogen_mul_sbk, const bool autogen_add_sbk)
     : autogen_mul_sbk_(autogen_mul_sbk), autogen_add_sbk_(autogen_add_sbk){}
+  SubKey(const bool autogen_mul_sbk, const bool autogen_add_sbk, const uint64_t seed)
+    : seed_(seed), explicit_seed_(true),
+      autogen_mul_sbk_(autogen_mul_sbk), autogen_add_sbk_(autogen_add_sbk){}
+  SubKey(const bool autogen_mul_sbk, const bool autogen_add_sbk, const SubKeyStorage storage)
+    : autogen_mul_sbk_(autogen_mul_sbk), autogen_add_sbk_(autogen_add_sbk),
+      seed_only_(storage == SubKeyStorage::seed_only){}
+  SubKey(const bool autogen_mul_sbk, const bool autogen_add_sbk, const SubKeyStorage storage,
+         const uint64_t seed)
+    : seed_(seed), explicit_seed_(true),
+      autogen_mul_sbk_(autogen_mul_sbk), autogen_add_sbk_(autogen_add_sbk),
+      seed_only_(storage == SubKeyStorage::seed_only){}
   ~SubKey() noexcept = default;
   SubKey(const SubKey&) = default;
   SubKey(SubKey&&) noexcept = default;
+
+  SubKey& operator=(const SubKey&) = default;
+  SubKey& operator=(SubKey&&) noexcept = default;
+  
+  uint64_t seed() const noexcept { return seed_; }
+  bool autogen_mul_sbk() const noexcept { return autogen_mul_sbk_; }
+  bool autogen_add_sbk() const noexcept { return autogen_add_sbk_; }
+
+  /// seedを明示的に指定して構築したかどうか
+  bool has_explicit_seed() const noexcept { return explicit_seed_; }
+
+  /**
+   * 自動生成するsub-keyのみからなり，入力に依存しない状態かどうか．
+   * この状態のsub-keyは事前に生成したもの（SubKeyPool）で置き換えられる．
+   * seedを明示的に指定した場合は，結果を再現できるよう置き換えない．
+   */
+  bool is_data_independent() const noexcept {
+    return !explicit_seed_ && !seed_only_ && num_moduli_ == 0
+      && (autogen_mul_sbk_ || mul_sbk_.ptr() == nullptr)
+      && (autogen_add_sbk_ || add_sbk_.ptr() == nullptr);
+  }
+
+  /**
+   * seedのみを保持しており，自動生成したsub-keyが展開されていない状態かどうか．
+   * この状態ではmul_sbk()/add_sbk()は自動生成分を含まないため，必要ならexpand()する．
+   */
+  bool is_seed_only() const noexcept { return seed_only_ && num_moduli_ > 0; }
   
   auto& mul_sbk() noexcept { return mul_sbk_; }
   const auto& mul_sbk() const noexcept { return mul_sbk_; }
   auto& add_sbk() noexcept { return add_sbk_; }
   const auto& add_sbk() const noexcept { return add_sbk_; }
 
+  bool has_mul_sbk() const noexcept {
+    return mul_sbk_.ptr() != nullptr || (is_seed_only() && autogen_mul_sbk_);
+  }
+
+  bool has_add_sbk() const noexcept {
+    return add_sbk_.ptr() != nullptr || (is_seed_only() && autogen_add_sbk_);
+  }
+
   void generate(const Ciphertext& ref, const Operator& op){
+    generate(EncodingParams(ref), ref.size(), ref.num_moduli(), op);
+  }
+
+  /// 参照暗号文の代わりに，そのエンコードパラメータ，サイズ，RNS基底の数を指定して生成する
+  void generate(const EncodingParams& ep, const size_t size, const int num_moduli,
+                const Operator& op){
+    ep_ = ep;
+    size_ = size;
+    num_moduli_ = num_moduli;
+    if( seed_only_ ){
+      // 乱数多項式は必要になった時点でseedから再生成する
+      return;
+    }
     if( autogen_mul_sbk_ ){
-      generate_mul_sbk(op, ref);
+      generate_mul_sbk(mul_sbk_, op);
     }
     if( autogen_add_sbk_ ){
-      generate_add_sbk(op, ref);
+      generate_add_sbk(add_sbk_, op);
     }
     return;
   }
 
+  /// seedのみを保持している場合，自動生成するsub-keyを展開して保持する
+  void expand(const Operator& op){
+    if( !is_seed_only() ){ return; }
+    if( autogen_mul_sbk_ ){
+      generate_mul_sbk(mul_sbk_, op);
+    }
+    if( autogen_add_sbk_ ){
+      generate_add_sbk(add_sbk_, op);
+    }
+    seed_only_ = false;
+  }
+
+  void expand_mul_sbk(Plaintext& out, const Operator& op) const {
+    if( is_seed_only() && autogen_mul_sbk_ ){
+      generate_mul_sbk(out, op);
+    }else{
+      op.copy(out, mul_sbk_);
+    }
+  }
+
+  void expand_add_sbk(Ciphertext& out, const Operator& op) const {
+    if( is_seed_only() && autogen_add_sbk_ ){
+      generate_add_sbk(out, op);
+    }else{
+      op.copy(out, add_sbk_);
+    }
+  }
+
   void randomize(Ciphertext& out, const Ciphertext& in, const Operator& op){
-    if( mul_sbk_.ptr() != nullptr ){
-      op.mul(out, in, mul_sbk_);
-      if( add_sbk_.ptr() != nullptr ){
-        op.add(out, add_sbk_);
+    // seedのみを保持している場合は，一時的に展開して用いる
+    Plaintext mul_sbk_tmp;
+    Ciphertext add_sbk_tmp;
+    if( is_seed_only() ){
+      if( autogen_mul_sbk_ ){ generate_mul_sbk(mul_sbk_tmp, op); }
+      if( autogen_add_sbk_ ){ generate_add_sbk(add_sbk_tmp, op); }
+    }
+    const Plaintext& mul_sbk = (mul_sbk_tmp.ptr() != nullptr ? mul_sbk_tmp : mul_sbk_);
+    const Ciphertext& add_sbk = (add_sbk_tmp.ptr() != nullptr ? add_sbk_tmp : add_sbk_);
+    
+    if( mul_sbk.ptr() != nullptr ){
+      if( add_sbk.ptr() != nullptr ){
+        op.mul_add(out, in, mul_sbk, add_sbk);
+      }else{
+        op.mul(out, in, mul_sbk);
       }
-    }else if( add_sbk_.ptr() != nullptr ){
-      op.add(out, in, add_sbk_);
+    }else if( add_sbk.ptr() != nullptr ){
+      op.add(out, in, add_sbk);
     }else{
       op.copy(out, in);
     }
@@ -48,70 +154,69 @@ public:
 
   Plaintext gen_inverted_mul_sbk(const Operator& op) const {
     Plaintext out;
-    op.invert(out, mul_sbk_);
+    if( is_seed_only() && autogen_mul_sbk_ ){
+      // 生成した乱数ベクトルをその場で逆元に置き換える
+      generate_mul_sbk(out, op);
+      op.invert(out);
+    }else{
+      op.invert(out, mul_sbk_);
+    }
     return out;
   }
 
   Ciphertext gen_negated_add_sbk(const Operator& op) const {
     Ciphertext out;
-    op.negate(out, add_sbk_);
+    if( is_seed_only() && autogen_add_sbk_ ){
+      generate_add_sbk(out, op);
+      op.negate(out, out);
+    }else{
+      op.negate(out, add_sbk_);
+    }
     return out;
   }
   
 private:
-  template<class Iterator>
-  void generate_random_vector(Iterator begin, Iterator end,
-                              const uint64_t min, const uint64_t max){
-    std::uniform_int_distribution<uint64_t> dist(min, max);
-    std::generate(begin, end, [&](){
-      return dist(engine_);
-    });
+  /// 同じseedからmul sub-keyとadd sub-keyを独立に生成するためのstream番号
+  static constexpr uint32_t stream_mul_sbk = 0;
+  static constexpr uint32_t stream_add_sbk = 1;
+
+  std::vector<uint64_t> get_moduli(const Operator& op) const {
+    std::vector<uint64_t> moduli(num_moduli_);
+    for( size_t i = 0; i < moduli.size(); ++i ){
+      moduli.at(i) = op.key_manager().get_modulus(i);
+    }
+    return moduli;
   }
       
-  void generate_add_sbk(const Operator& op, const Ciphertext& ref){
-    const size_t size = ref.ref().size();
-    const size_t num_moduli = ref.num_moduli();
+  void generate_add_sbk(Ciphertext& out, const Operator& op) const {
     const size_t n = op.key_manager().poly_degree();
-    std::vector<uint64_t> vec(size * num_moduli * n, 0);
-    auto itr = vec.begin();
-    for( size_t i = 0; i < num_moduli; ++i ){
-      generate_random_vector(itr, itr + n, 0, op.key_manager().get_modulus(i) - 1);
-      itr += n;
-    }
-    
-    EncodingParams ep;
-    ep.configure(ref);
-    // ランダムベクトルを設定する
-    add_sbk_.reallocate(op.key_manager());
-    add_sbk_.set_data(std::move(vec), op.key_manager(), ep);
     
+    out.reallocate(op.key_manager());
+    out.resize(op.key_manager(), ep_, size_);
+    // 第0成分のみにランダムベクトルを設定する（残りの成分は0のまま）
+    SubKeyGenerator(seed_).generate(out.data(), n, get_moduli(op), 0, stream_add_sbk);
   }
 
-  void generate_mul_sbk(const Operator& op, const Ciphertext& ref){
-    const size_t num_moduli = ref.num_moduli();
+  void generate_mul_sbk(Plaintext& out, const Operator& op) const {
     const size_t n = op.key_manager().poly_degree();
-    // ランダムベクトルの生成
-    std::vector<uint64_t> vec(1 * num_moduli * n, 0);
-    auto itr = vec.begin();
-    for( size_t i = 0; i < num_moduli; ++i ){
-      generate_random_vector(itr, itr + n, 1, op.key_manager().get_modulus(i) - 1);
-      itr += n;
-    }
     
-    EncodingParams ep;
-    ep.configure(ref);
     // ランダム化する際にscaling factorを変更しないため，1.0に設定する．
-    ep.scale = 1.0;
-    // ランダムベクトルを設定する
-    mul_sbk_.reallocate(op.key_manager());
-    mul_sbk_.set_data(std::move(vec), op.key_manager(), ep);
+    const EncodingParams ep = EncodingParams(ep_).set_scale(1.0);
+    out.reallocate(op.key_manager());
+    out.resize(op.key_manager(), ep);
+    // 逆元が存在するように[1, q-1]から生成する
+    SubKeyGenerator(seed_).generate(out.data(), n, get_moduli(op), 1, stream_mul_sbk);
   }
 
   
-  const unsigned int seed_ = std::random_device{}();
-  
-  std::mt19937_64 engine_;
+  uint64_t seed_ = [](){
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+  }();
 
+  /// trueの場合，seed_は構築時に指定されたもの
+  bool explicit_seed_ = false;
+  
   bool autogen_mul_sbk_;
   
   Plaintext mul_sbk_;
@@ -119,6 +224,14 @@ private:
   bool autogen_add_sbk_;
 
   Ciphertext add_sbk_;
+
+  /// trueの場合，自動生成するsub-keyはseedのみを保持し，必要な時に再生成する
+  bool seed_only_ = false;
+
+  /// 自動生成するsub-keyの再生成に必要な情報（generate()時の参照暗号文から設定）
+  EncodingParams ep_;
+  size_t size_ = 0;
+  int num_moduli_ = 0;
   
   
 };
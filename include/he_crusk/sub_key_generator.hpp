@@ -0,0 +1,88 @@
+#pragma once
+
+#include<algorithm>
+#include<array>
+#include<bit>
+#include<cstdint>
+#include<vector>
+
+#include"util/philox.hpp"
+
+namespace he_crusk{
+/**
+ * sub-keyの乱数多項式を生成するエンジン
+ *
+ * 各RNS limbをblock_size個の係数ごとのブロックに分割し，(stream, limb, block)ごとに
+ * 独立したPhiloxのcounter列を割り当てる．ブロック内の棄却サンプリングはそのブロックの
+ * counter列のみを消費するため，スレッド数や実行順によらず同じseedから同じ出力が得られる．
+ */
+class SubKeyGenerator{
+public:
+  static constexpr size_t block_size = 1024;
+
+  SubKeyGenerator(const uint64_t seed) : key_(util::Philox4x32::make_key(seed)){}
+  ~SubKeyGenerator() = default;
+  SubKeyGenerator(const SubKeyGenerator&) = default;
+  SubKeyGenerator(SubKeyGenerator&&) noexcept = default;
+
+  /**
+   * out[i*n, (i+1)*n)に[min_value, moduli[i]-1]の一様乱数を書き込む．
+   * streamが異なれば同じseedでも独立な乱数列となる．
+   */
+  void generate(uint64_t* out, const size_t n, const std::vector<uint64_t>& moduli,
+                const uint64_t min_value, const uint32_t stream) const {
+    const size_t num_moduli = moduli.size();
+    const size_t num_blocks = (n + block_size - 1) / block_size;
+#pragma omp parallel for collapse(2) schedule(static)
+    for( size_t i = 0; i < num_moduli; ++i ){
+      for( size_t b = 0; b < num_blocks; ++b ){
+        const size_t begin = b * block_size;
+        generate_block(out + i * n + begin, std::min(block_size, n - begin),
+                       moduli[i] - min_value, min_value, stream_id(stream, i, b));
+      }
+    }
+  }
+
+private:
+  static constexpr uint64_t stream_id(const uint32_t stream, const size_t limb, const size_t block) noexcept {
+    return (static_cast<uint64_t>(stream) << 48)
+      | (static_cast<uint64_t>(limb) << 32)
+      | static_cast<uint64_t>(block);
+  }
+
+  /// [offset, offset + range)の一様乱数をlen個書き込む
+  void generate_block(uint64_t* out, const size_t len, const uint64_t range,
+                      const uint64_t offset, const uint64_t stream) const {
+    const int bit_count = std::bit_width(range - 1);
+    const uint64_t mask = (bit_count >= 64 ? ~uint64_t{0} : (uint64_t{1} << bit_count) - 1);
+
+    std::array<uint64_t, block_size> candidates;
+    uint64_t counter = 0;
+    size_t filled = 0;
+    while( filled < len ){
+      // 候補をまとめて生成する（各候補は独立なので，ベクトル化できる）
+#pragma omp simd
+      for( size_t j = 0; j < block_size / 2; ++j ){
+        const auto r = util::Philox4x32::generate64(
+            util::Philox4x32::make_counter(counter + j, stream), key_
+        );
+        candidates[2 * j] = r[0] & mask;
+        candidates[2 * j + 1] = r[1] & mask;
+      }
+      counter += block_size / 2;
+
+      // 受理された候補のみを詰めて書き込む
+      for( size_t j = 0; j < block_size && filled < len; ++j ){
+        if( candidates[j] < range ){
+          out[filled++] = candidates[j] + offset;
+        }
+      }
+    }
+  }
+
+  util::Philox4x32::Key key_;
+
+};
+
+
+}  // namespace he_crusk
@@ -0,0 +1,223 @@
+#pragma once
+
+#include<condition_variable>
+#include<deque>
+#include<exception>
+#include<memory>
+#include<mutex>
+#include<optional>
+#include<thread>
+#include<vector>
+
+#include"he_crusk/sub_key.hpp"
+
+namespace he_crusk{
+/**
+ * 事前生成したsub-keyを保持するプール
+ *
+ * sub-keyの乱数多項式は入力データに依存しないため，オフラインにバックグラウンドの
+ * workerスレッドで生成しておき，オンライン処理（HeCrusk::add）ではO(1)で取り出す．
+ * 各エントリは(エンコードパラメータ，暗号文サイズ，RNS基底の数，自動生成するsub-keyの種類)で
+ * 区別され，それぞれ最大capacity個まで補充される．未登録のエントリはacquire()の初回で登録される．
+ * workerでの生成が例外を投げた場合，以降の補充は行わず，その例外をacquire()とwait_until_full()で再送出する．
+ */
+template<template<class> class Impl>
+class SubKeyPool{
+public:
+  using EncodingParams = he_wrapper_tmpl::EncodingParams<Impl>;
+  using Ciphertext = he_wrapper_tmpl::Ciphertext<Impl>;
+  using Operator = he_wrapper_tmpl::Operator<Impl>;
+
+  struct Stats{
+    /// 全エントリで保持しているsub-keyの数
+    size_t depth = 0;
+    /// acquire()でsub-keyを取り出せた回数
+    size_t hits = 0;
+    /// acquire()でsub-keyが無く，呼び出し側で生成する必要があった回数
+    size_t misses = 0;
+  };
+
+  SubKeyPool(std::shared_ptr<Operator> op, const size_t capacity, const size_t num_workers=1)
+    : op_(op), capacity_(capacity){
+    for( size_t i = 0; i < num_workers; ++i ){
+      workers_.emplace_back([this](){ run(); });
+    }
+  }
+  ~SubKeyPool(){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for( auto& worker : workers_ ){
+      worker.join();
+    }
+  }
+  SubKeyPool(const SubKeyPool&) = delete;
+  SubKeyPool(SubKeyPool&&) = delete;
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  /// refと同じ形状のsub-keyを補充対象として登録する
+  void reserve(const Ciphertext& ref, const bool autogen_mul_sbk, const bool autogen_add_sbk){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      find_or_insert(ref, autogen_mul_sbk, autogen_add_sbk);
+    }
+    cv_.notify_all();
+  }
+
+  /**
+   * refと同じ形状のsub-keyを1つ取り出す．
+   * プールが空の場合はstd::nulloptを返し，workerに補充を促す．
+   * workerでの生成が失敗していた場合はその例外を投げる．
+   */
+  std::optional<SubKey<Impl>> acquire(const Ciphertext& ref,
+                                      const bool autogen_mul_sbk, const bool autogen_add_sbk){
+    std::optional<SubKey<Impl>> out;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if( error_ ){ std::rethrow_exception(error_); }
+      auto& entry = find_or_insert(ref, autogen_mul_sbk, autogen_add_sbk);
+      if( entry.ready.empty() ){
+        ++stats_.misses;
+      }else{
+        out.emplace(std::move(entry.ready.front()));
+        entry.ready.pop_front();
+        --stats_.depth;
+        ++stats_.hits;
+      }
+    }
+    cv_.notify_one();
+    return out;
+  }
+
+  /// refと同じ形状のsub-keyの保持数
+  size_t depth(const Ciphertext& ref, const bool autogen_mul_sbk, const bool autogen_add_sbk) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto* entry = find(EncodingParams(ref), ref.size(), ref.num_moduli(),
+                             autogen_mul_sbk, autogen_add_sbk);
+    return (entry == nullptr ? 0 : entry->ready.size());
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  /// 全エントリの補充が完了するまで待つ（workerでの生成が失敗した場合はその例外を投げる）
+  void wait_until_full() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    full_cv_.wait(lock, [this](){ return stop_ || error_ || is_full(); });
+    if( error_ ){ std::rethrow_exception(error_); }
+  }
+
+private:
+  struct Entry{
+    EncodingParams ep;
+    size_t size;
+    int num_moduli;
+    bool autogen_mul_sbk;
+    bool autogen_add_sbk;
+    std::deque<SubKey<Impl>> ready;
+    /// workerが生成中のsub-keyの数
+    size_t pending = 0;
+  };
+
+  const Entry* find(const EncodingParams& ep, const size_t size, const int num_moduli,
+                    const bool autogen_mul_sbk, const bool autogen_add_sbk) const {
+    for( const auto& entry : entries_ ){
+      if( entry->ep == ep && entry->size == size && entry->num_moduli == num_moduli
+          && entry->autogen_mul_sbk == autogen_mul_sbk && entry->autogen_add_sbk == autogen_add_sbk ){
+        return entry.get();
+      }
+    }
+    return nullptr;
+  }
+
+  Entry& find_or_insert(const Ciphertext& ref, const bool autogen_mul_sbk, const bool autogen_add_sbk){
+    const EncodingParams ep(ref);
+    if( const auto* entry = find(ep, ref.size(), ref.num_moduli(), autogen_mul_sbk, autogen_add_sbk) ){
+      return const_cast<Entry&>(*entry);
+    }
+    auto& entry = entries_.emplace_back(std::make_unique<Entry>());
+    entry->ep = ep;
+    entry->size = ref.size();
+    entry->num_moduli = ref.num_moduli();
+    entry->autogen_mul_sbk = autogen_mul_sbk;
+    entry->autogen_add_sbk = autogen_add_sbk;
+    return *entry;
+  }
+
+  /// 補充が必要なエントリ（なければnullptr）
+  Entry* next_entry() const {
+    for( const auto& entry : entries_ ){
+      if( entry->ready.size() + entry->pending < capacity_ ){
+        return entry.get();
+      }
+    }
+    return nullptr;
+  }
+
+  bool is_full() const {
+    for( const auto& entry : entries_ ){
+      if( entry->ready.size() < capacity_ ){ return false; }
+    }
+    return true;
+  }
+
+  void run(){
+    std::unique_lock<std::mutex> lock(mutex_);
+    while( true ){
+      Entry* entry = nullptr;
+      cv_.wait(lock, [&](){ return stop_ || (!error_ && (entry = next_entry()) != nullptr); });
+      if( stop_ ){ return; }
+
+      ++entry->pending;
+      lock.unlock();
+      // 生成はロックの外で行う（entryはunique_ptrで保持しているため，entries_が伸長しても無効にならない）
+      SubKey<Impl> sbk(entry->autogen_mul_sbk, entry->autogen_add_sbk);
+      try{
+        sbk.generate(entry->ep, entry->size, entry->num_moduli, *op_);
+      }catch( ... ){
+        lock.lock();
+        --entry->pending;
+        if( !error_ ){ error_ = std::current_exception(); }
+        full_cv_.notify_all();
+        continue;
+      }
+      lock.lock();
+      --entry->pending;
+      entry->ready.push_back(std::move(sbk));
+      ++stats_.depth;
+      if( is_full() ){
+        full_cv_.notify_all();
+      }
+    }
+  }
+
+  std::shared_ptr<Operator> op_;
+
+  const size_t capacity_;
+
+  std::vector<std::unique_ptr<Entry>> entries_;
+
+  Stats stats_;
+
+  bool stop_ = false;
+
+  /// workerでの生成で最初に発生した例外
+  std::exception_ptr error_;
+
+  mutable std::mutex mutex_;
+
+  std::condition_variable cv_;
+
+  mutable std::condition_variable full_cv_;
+
+  std::vector<std::thread> workers_;
+
+};
+
+
+}  // namespace he_crusk
@@ -2,6 +2,7 @@
 
 #include"he_wrapper_tmpl/raw_scalar.hpp"
 #include"he_wrapper_tmpl/raw_vec.hpp"
+#include"he_wrapper_tmpl/base/rotation_planner.hpp"
 
 namespace he_wrapper_tmpl{
 template<class T>
@@ -32,6 +33,15 @@ class SymCiphertext;
 template<template<class> class Impl>
 class Ciphertext;
 
+template<template<class> class Impl>
+class ObjectPool;
+
+template<template<class> class Impl>
+class EncodedRationalScalar;
+
+template<template<class> class Impl>
+class EncodeCache;
+
 enum class OpType : int {
   npp,
   allocate,
@@ -58,4 +68,7 @@ enum class OpType : int {
 }  // namespace he_wrapper_tmpl
 
 #include"he_wrapper_tmpl/base/operator.hpp"
+#include"he_wrapper_tmpl/base/object_pool.hpp"
+#include"he_wrapper_tmpl/base/encode_cache.hpp"
+#include"he_wrapper_tmpl/base/polynomial_evaluator.hpp"
 
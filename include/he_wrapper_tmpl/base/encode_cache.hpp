@@ -0,0 +1,131 @@
+#pragma once
+
+#include<functional>
+#include<list>
+#include<mutex>
+#include<string>
+#include<string_view>
+#include<unordered_map>
+
+namespace he_wrapper_tmpl{
+/**
+ * エンコード済みの平文のキャッシュ
+ *
+ * (スロットの値, レベル, scale)ごとに平文を保持し，同じ定数ベクトルを繰り返しかける場合のエンコードを省略する．
+ * 保持する平文の数がcapacity()を超えた場合は，最も長く参照されていないものから破棄する（LRU）．
+ * 返す平文はキャッシュと領域を共有する（copy-on-write）ため，書き込んでもキャッシュには影響しない．
+ * スレッドセーフであり，エンコードはロックの外で行う．
+ */
+template<template<class> class Impl>
+class EncodeCache{
+public:
+  explicit EncodeCache(const size_t capacity = 64) : capacity_(capacity){}
+  ~EncodeCache() = default;
+  EncodeCache(const EncodeCache&) = delete;
+  EncodeCache(EncodeCache&&) = delete;
+
+  size_t capacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+  }
+
+  /// 保持する平文の最大数を設定する（0の場合はキャッシュしない）
+  void capacity(const size_t in){
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = in;
+    evict();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  void clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    entries_.clear();
+  }
+
+  /**
+   * (in, level, scale)に対応する平文を返す．
+   * キャッシュにない場合はencode(out)で生成し，登録する．
+   */
+  template<class MsgType, class Encode>
+  Plaintext<Impl> get(const RawVec<MsgType>& in, const int level, const double scale,
+                      Encode&& encode){
+    const KeyView key{bytes(in), level, scale};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto itr = index_.find(key);
+      if( itr != index_.end() ){
+        entries_.splice(entries_.begin(), entries_, itr->second);
+        return itr->second->plaintext;
+      }
+    }
+
+    Plaintext<Impl> out;
+    encode(out);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if( capacity_ == 0 || index_.count(key) > 0 ){ return out; }
+    entries_.push_front(Entry{std::string(key.values), level, scale, out});
+    const auto& entry = entries_.front();
+    index_.emplace(KeyView{entry.values, entry.level, entry.scale}, entries_.begin());
+    evict();
+    return out;
+  }
+
+private:
+  struct Entry{
+    std::string values;
+    int level;
+    double scale;
+    Plaintext<Impl> plaintext;
+  };
+
+  /// 検索キー（valuesはEntry::valuesまたは検索する値のバイト列を指す）
+  struct KeyView{
+    std::string_view values;
+    int level;
+    double scale;
+
+    bool operator==(const KeyView&) const = default;
+  };
+
+  struct Hash{
+    size_t operator()(const KeyView& in) const noexcept {
+      size_t h = std::hash<std::string_view>()(in.values);
+      h ^= std::hash<int>()(in.level) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+      h ^= std::hash<double>()(in.scale) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+      return h;
+    }
+  };
+
+  template<class MsgType>
+  static std::string_view bytes(const RawVec<MsgType>& in){
+    return std::string_view(reinterpret_cast<const char*>(in.cref().data()),
+                            in.cref().size() * sizeof(MsgType));
+  }
+
+  void evict(){
+    while( entries_.size() > capacity_ ){
+      const auto& entry = entries_.back();
+      index_.erase(KeyView{entry.values, entry.level, entry.scale});
+      entries_.pop_back();
+    }
+  }
+
+  mutable std::mutex mutex_;
+
+  size_t capacity_;
+
+  /// 参照の新しい順
+  std::list<Entry> entries_;
+
+  std::unordered_map<KeyView, typename std::list<Entry>::iterator, Hash> index_;
+
+};
+
+
+}  // namespace he_wrapper_tmpl
@@ -0,0 +1,165 @@
+#pragma once
+
+#include<map>
+#include<memory>
+#include<mutex>
+#include<type_traits>
+#include<utility>
+#include<vector>
+
+namespace he_wrapper_tmpl{
+/**
+ * 一時的な暗号文・平文の領域を再利用するプール
+ *
+ * 領域は(レベル, 成分数)ごとに保持し，貸し出したLeaseの破棄時に同じ区分へ返却する．
+ * 同じ形の一時変数を繰り返し用いる評価では，2回目以降は新たな領域の確保が起きない．
+ * 貸し出す暗号文・平文の値は不定であり，out-of-placeな演算の出力先として用いる．
+ * スレッドセーフであり，バッチ版の演算の中からも用いることができる．
+ */
+template<template<class> class Impl>
+class ObjectPool : public std::enable_shared_from_this<ObjectPool<Impl>>{
+public:
+  /**
+   * プールから借りた暗号文・平文
+   *
+   * 破棄時に領域をプールへ返却する．
+   * ただし，copy-on-writeにより領域が他の暗号文・平文と共有されている場合は返却せずに手放す．
+   */
+  template<class T>
+  class Lease{
+  public:
+    Lease(std::shared_ptr<ObjectPool> pool, const std::pair<int, size_t>& key, T&& obj)
+      : pool_(std::move(pool)), key_(key), obj_(std::move(obj)){}
+    ~Lease(){ release(); }
+    Lease(const Lease&) = delete;
+    Lease(Lease&& in) noexcept
+      : pool_(std::move(in.pool_)), key_(in.key_), obj_(std::move(in.obj_)){}
+
+    Lease& operator=(const Lease&) = delete;
+    Lease& operator=(Lease&& in) noexcept {
+      if( this != &in ){
+        release();
+        pool_ = std::move(in.pool_);
+        key_ = in.key_;
+        obj_ = std::move(in.obj_);
+      }
+      return *this;
+    }
+
+    T& get() noexcept { return obj_; }
+    const T& get() const noexcept { return obj_; }
+    T& operator*() noexcept { return obj_; }
+    const T& operator*() const noexcept { return obj_; }
+    T* operator->() noexcept { return &obj_; }
+    const T* operator->() const noexcept { return &obj_; }
+    operator T&() noexcept { return obj_; }
+    operator const T&() const noexcept { return obj_; }
+
+  private:
+    void release() noexcept {
+      if( pool_ == nullptr ){ return; }
+      pool_->give_back(key_, std::move(obj_));
+      pool_ = nullptr;
+    }
+
+    std::shared_ptr<ObjectPool> pool_;
+
+    std::pair<int, size_t> key_;
+
+    T obj_;
+
+  };
+
+  ObjectPool() = default;
+  ~ObjectPool() = default;
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool(ObjectPool&&) = delete;
+
+  /**
+   * レベルlevelで成分数sizeまで再確保なしに格納できる暗号文を借りる．
+   * プールに該当する領域がない場合のみ，新たに確保する．
+   */
+  Lease<Ciphertext<Impl>> ciphertext(const Operator<Impl>& op, const int level,
+                                     const size_t size = 2){
+    const auto key = std::make_pair(level, size);
+    Ciphertext<Impl> out;
+    if( !take(ciphertexts_, key, out) ){
+      op.allocate(out, level);
+      if( size > 3 && level >= 0 ){
+        EncodingParams<Impl> ep = op.get_initial_encoding_params();
+        op.mod_down(ep, op.level(ep) - level);
+        op.reserve(out, ep, size);
+      }
+      count_allocation();
+    }
+    return Lease<Ciphertext<Impl>>(this->shared_from_this(), key, std::move(out));
+  }
+
+  /// レベルlevelの平文を借りる
+  Lease<Plaintext<Impl>> plaintext(const Operator<Impl>& op, const int level){
+    const auto key = std::make_pair(level, size_t(1));
+    Plaintext<Impl> out;
+    if( !take(plaintexts_, key, out) ){
+      op.allocate(out, level);
+      count_allocation();
+    }
+    return Lease<Plaintext<Impl>>(this->shared_from_this(), key, std::move(out));
+  }
+
+  /// これまでに新たに確保した暗号文・平文の数（定常状態で増えないことの確認に用いる）
+  size_t num_allocations() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_allocations_;
+  }
+
+  /// 返却済みの領域を全て解放する
+  void clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    ciphertexts_.clear();
+    plaintexts_.clear();
+  }
+
+private:
+  template<class T>
+  bool take(std::map<std::pair<int, size_t>, std::vector<T>>& buckets,
+            const std::pair<int, size_t>& key, T& out){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto itr = buckets.find(key);
+    if( itr == buckets.end() || itr->second.empty() ){ return false; }
+    out = std::move(itr->second.back());
+    itr->second.pop_back();
+    return true;
+  }
+
+  void count_allocation(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++num_allocations_;
+  }
+
+  template<class T>
+  void give_back(const std::pair<int, size_t>& key, T&& in) noexcept {
+    if( in.ptr() == nullptr || in.ptr().use_count() > 1 ){ return; }
+    try{
+      std::lock_guard<std::mutex> lock(mutex_);
+      if constexpr( std::is_same_v<T, Ciphertext<Impl>> ){
+        ciphertexts_[key].emplace_back(std::move(in));
+      }else{
+        plaintexts_[key].emplace_back(std::move(in));
+      }
+    }catch(...){
+      // 返却できない場合は領域を手放す
+    }
+  }
+
+  mutable std::mutex mutex_;
+
+  std::map<std::pair<int, size_t>, std::vector<Ciphertext<Impl>>> ciphertexts_;
+
+  std::map<std::pair<int, size_t>, std::vector<Plaintext<Impl>>> plaintexts_;
+
+  size_t num_allocations_ = 0;
+
+};
+
+
+}  // namespace he_wrapper_tmpl
@@ -2,11 +2,16 @@
 
 #include<algorithm>
 #include<cassert>
+#include<cmath>
 #include<filesystem>
 #include<fstream>
 #include<numeric>
+#include<span>
+
+#include<omp.h>
 
 #include"util/error.hpp"
+#include"util/for_loop.hpp"
 
 namespace he_wrapper_tmpl{
 template<template<class> class Impl>
@@ -34,6 +39,28 @@ public:
   EncodingParams<Impl> get_initial_encoding_params() const;
   ////////////////////////////////////////
 
+
+  ////////////////////////////////////////
+  // Encoding parameters tracking
+  ////////////////////////////////////////
+  /**
+   * 暗号文に対する演算によるエンコードパラメータ（level・scale）の変化を，HE演算を行わずに求める．
+   * 暗号化する前に各入力のエンコードパラメータを計画するために用いる．
+   * 演算できないエンコードパラメータの組み合わせに対しては，暗号文の場合と同様に例外を投げる．
+   */
+  int level(const EncodingParams<Impl>& in) const;
+
+  void add(EncodingParams<Impl>& out, const EncodingParams<Impl>& in) const;
+
+  void mul(EncodingParams<Impl>& out, const EncodingParams<Impl>& in) const;
+
+  void square(EncodingParams<Impl>& out) const { mul(out, out); }
+
+  void rescale(EncodingParams<Impl>& out) const;
+
+  void mod_down(EncodingParams<Impl>& out, const int n) const;
+  ////////////////////////////////////////
+
   
   ////////////////////////////////////////
   // Operation execution
@@ -83,11 +110,36 @@ public:
     out.reallocate(key_manager(), level, scale);
   }
 
+  /**
+   * outの成分数がsizeに達するまで再確保が起きないよう，容量を確保する．
+   * 成分数が増加する演算を繰り返す場合に，事前に最終的な成分数で呼び出す．
+   */
+  template<class T>
+  void reserve(T& out, const EncodingParams<Impl>& ep, const size_t size) const {
+    out.reserve(key_manager(), ep, size);
+  }
+
   template<class T>
   void deallocate(T& out) const {
     out.deallocate(key_manager());
   }
 
+  /**
+   * object_pool()から，レベルlevelで成分数sizeまで格納できる一時的な暗号文を借りる．
+   * 返り値の破棄時に領域はプールへ返却され，次の呼び出しで再利用される（値は不定）．
+   */
+  auto lease_ciphertext(const int level, const size_t size = 2) const {
+    return object_pool_->ciphertext(*this, level, size);
+  }
+
+  /// object_pool()から，レベルlevelの一時的な平文を借りる
+  auto lease_plaintext(const int level) const {
+    return object_pool_->plaintext(*this, level);
+  }
+
+  /// 一時的な暗号文・平文の領域を再利用するプール
+  ObjectPool<Impl>& object_pool() const { return *object_pool_; }
+
   /**
    * ScalarPlaintext, Plaintext, Ciphertextのdata_をnullptrにする．
    */
@@ -124,6 +176,30 @@ public:
     encode(out, in, params);
     return out;
   }
+
+  /**
+   * in_numerator / in_denominatorを有理数スカラーとしてエンコードする（scaleはparams.scale）．
+   * limbごとの剰余と乗算用の前計算を1度だけ行うため，同じスカラーを繰り返しかける場合に用いる．
+   */
+  template<class MsgType>
+  void encode(EncodedRationalScalar<Impl>& out,
+              const RawScalar<MsgType>& in_numerator,
+              const RawScalar<MsgType>& in_denominator,
+              const EncodingParams<Impl>& params) const;
+  
+  /**
+   * inをparamsでエンコードした平文を返す．
+   * 結果はencode_cache()に保持し，同じ(値, レベル, scale)のエンコードでは再利用する．
+   */
+  template<class MsgType>
+  Plaintext<Impl> encode_cached(const RawVec<MsgType>& in,
+                                const EncodingParams<Impl>& params) const {
+    return encode_cache_->get(in, level(params), params.scale,
+                              [&](Plaintext<Impl>& out){ encode(out, in, params); });
+  }
+
+  /// エンコード済みの平文のキャッシュ
+  EncodeCache<Impl>& encode_cache() const { return *encode_cache_; }
   
   template<class MsgType>
   void decode(RawVec<MsgType>& out,
@@ -139,6 +215,10 @@ public:
   void encrypt(Ciphertext<Impl>& out,
                const Plaintext<Impl>& in) const;
 
+  /**
+   * inを暗号化し，サイズsizeの暗号文とする．
+   * 拡張した成分には0の暗号文を重ねるため，復号結果はinのまま（scaling factorも変化しない）．
+   */
   void encrypt(Ciphertext<Impl>& out,
                const Plaintext<Impl>& in,
                const size_t size) const;
@@ -192,28 +272,25 @@ public:
   ////////////////////////////////////////
   // Move
   ////////////////////////////////////////
+  /// inの領域をそのままoutに移す（複製は行わず，inは空となる）
   void move(Plaintext<Impl>& out,
             Plaintext<Impl>& in) const {
-    allocate(out, -1, 0.0);
-    out.ref() = std::move(in.ref());
+    out.ptr() = std::move(in.ptr());
   }
 
   void move(Plaintext<Impl>& out,
             Plaintext<Impl>&& in) const {
-    allocate(out, -1, 0.0);
-    out.ref() = std::move(in.ref());
+    out.ptr() = std::move(in.ptr());
   }
 
   void move(Ciphertext<Impl>& out,
             Ciphertext<Impl>& in) const {
-    allocate(out, -1, 0.0);
-    out.ref() = std::move(in.ref());
+    out.ptr() = std::move(in.ptr());
   }
 
   void move(Ciphertext<Impl>& out,
             Ciphertext<Impl>&& in) const {
-    allocate(out, -1, 0.0);
-    out.ref() = std::move(in.ref());
+    out.ptr() = std::move(in.ptr());
   }
   ////////////////////////////////////////
 
@@ -221,11 +298,19 @@ public:
   ////////////////////////////////////////
   // Copy
   ////////////////////////////////////////
+  /**
+   * outにinを複製する（copy-on-write）．
+   * outが専有する領域をもたない場合はinと領域を共有し，実際の複製はいずれかへの最初の書き込み時に行う．
+   * outが専有する領域をもつ場合（reserve()やプールから借りた領域等）は，確保済みの容量を再利用するためその領域へ複製する．
+   */
   void copy(Plaintext<Impl>& out,
             const Plaintext<Impl>& in) const {
     check_ptr(in, "in");
     if( out.ptr() == in.ptr() ){ return; }
-    allocate(out, -1, 0.0);
+    if( out.ptr() == nullptr || out.ptr().use_count() > 1 ){
+      out.ptr() = in.ptr();
+      return;
+    }
     out.ref() = in.cref();
   }
 
@@ -233,7 +318,10 @@ public:
             const Ciphertext<Impl>& in) const {
     check_ptr(in, "in");
     if( out.ptr() == in.ptr() ){ return; }
-    allocate(out, -1, 0.0);
+    if( out.ptr() == nullptr || out.ptr().use_count() > 1 ){
+      out.ptr() = in.ptr();
+      return;
+    }
     out.ref() = in.cref();
   }
   ////////////////////////////////////////
@@ -277,6 +365,18 @@ public:
   void invert(Plaintext<Impl>& out,
               const Plaintext<Impl>& in) const;
 
+  void invert(Plaintext<Impl>& out) const;
+
+  /**
+   * 暗号文を係数とする多項式p(y) = sum_m inout[m] y^mを，p(y + shift)の係数に置き換える．
+   * すなわち，inout[i] <- sum_{m >= i} C(m, i) shift^{m-i} inout[m]．
+   *
+   * shiftは第0成分以外が0の自明な暗号文とし，inout[m] * shift^{m-i}のscaling factorは
+   * inout[i]と一致している必要がある．inout[i]のサイズはmax_{m >= i}(inout[m]のサイズ + m - i)となる．
+   */
+  void taylor_shift(const std::vector<Ciphertext<Impl>*>& inout,
+                    const Ciphertext<Impl>& shift) const;
+
 
 
   void add(Plaintext<Impl>& out,
@@ -331,17 +431,51 @@ public:
            const Ciphertext<Impl>& in1,
            const Ciphertext<Impl>& in2) const;
 
+  /**
+   * out = in1 * in2 + in3を，各入力を1回ずつ読み出す1パスで計算する．
+   * outはin1またはin3と同じでもよい．
+   */
+  void mul_add(Ciphertext<Impl>& out,
+               const Ciphertext<Impl>& in1,
+               const Plaintext<Impl>& in2,
+               const Ciphertext<Impl>& in3) const;
+
+  /**
+   * out = out * x + coeffを計算する（xはサイズ2の暗号文）．
+   * Horner法の1ステップに相当し，outは成分数が1つ増えた暗号文となる．
+   * 必要な容量をreserve()しておけば再確保は起きない．
+   */
+  void mul_add(Ciphertext<Impl>& out,
+               const Ciphertext<Impl>& x,
+               const Ciphertext<Impl>& coeff) const;
+
+  /// in_numerator / in_denominatorをepでエンコードしてかける
   template<class MsgType>
   void mul(Plaintext<Impl>& out,
            const RawScalar<MsgType>& in_numerator,
            const RawScalar<MsgType>& in_denominator,
-           const EncodingParams<Impl>& ep) const;
+           const EncodingParams<Impl>& ep) const {
+    EncodedRationalScalar<Impl> scalar;
+    encode(scalar, in_numerator, in_denominator, ep);
+    mul(out, scalar);
+  }
     
   template<class MsgType>
   void mul(Ciphertext<Impl>& out,
            const RawScalar<MsgType>& in_numerator,
            const RawScalar<MsgType>& in_denominator,
-           const EncodingParams<Impl>& ep) const;
+           const EncodingParams<Impl>& ep) const {
+    EncodedRationalScalar<Impl> scalar;
+    encode(scalar, in_numerator, in_denominator, ep);
+    mul(out, scalar);
+  }
+
+  /// エンコード済みのスカラーをかける（同じスカラーを繰り返しかける場合はエンコードを再利用する）
+  void mul(Plaintext<Impl>& out,
+           const EncodedRationalScalar<Impl>& in) const;
+
+  void mul(Ciphertext<Impl>& out,
+           const EncodedRationalScalar<Impl>& in) const;
 
   template<class MsgType>
   void mul(Ciphertext<Impl>& out,
@@ -351,6 +485,28 @@ public:
     mul(out, RawScalar<MsgType>(in_numerator), RawScalar<MsgType>(in_denominator), ep);
   }
 
+  /**
+   * スロットごとの定数inをepでエンコードしてかける．
+   * エンコード結果はencode_cache()に保持し，同じ定数ベクトルの乗算ではエンコードを省略する．
+   * スロットごとの定数は実数（double）としてエンコードする．有理数を厳密に（分母のmod qでの逆元として）
+   * 扱えるのは全スロットが同じ値のスカラーの場合のみであり，その場合はEncodedRationalScalarを用いる．
+   */
+  template<class MsgType>
+  void mul(Ciphertext<Impl>& out,
+           const RawVec<MsgType>& in,
+           const EncodingParams<Impl>& ep) const {
+    mul(out, encode_cached(in, ep));
+  }
+
+  template<class MsgType>
+  void mul(Ciphertext<Impl>& out,
+           const Ciphertext<Impl>& in1,
+           const RawVec<MsgType>& in2,
+           const EncodingParams<Impl>& ep) const {
+    mul(out, in1, encode_cached(in2, ep));
+  }
+
+
 
   
   void square(Ciphertext<Impl>& out) const;
@@ -392,6 +548,19 @@ public:
   void rotate(Ciphertext<Impl>& out,
               const Ciphertext<Impl>& in, const int shift_count) const;
 
+  /**
+   * out[i]をinをsteps[i]だけ回転した暗号文とする．
+   * 鍵交換の前半（inの分解とNTT）を1度だけ行い，全ての回転で共有する（hoisted rotation）．
+   * 鍵が直接存在しない回転（has_rotation_key()がfalse）は，rotate()と同様に個別に計算する．
+   * inはoutの要素であってはならない．
+   */
+  void rotate_many(std::vector<Ciphertext<Impl>>& out,
+                   const Ciphertext<Impl>& in,
+                   const std::vector<int>& steps) const;
+
+  /// shift_countの回転の鍵が（他の回転の合成でなく）直接存在するか
+  bool has_rotation_key(const int shift_count) const;
+
 
   
   void bootstrap(Ciphertext<Impl>& out) const;
@@ -403,6 +572,107 @@ public:
     bootstrap(out);
   }
 
+  ////////////////////////////////////////
+  // Batch operations
+  ////////////////////////////////////////
+  /*
+   * 要素ごとに同じ演算を行うバッチ版（要素ごとにOpenMPで並列に実行する）．
+   * out[i]はin[i]（in1[i], in2[i]）のみから計算するため，各引数の要素数は一致していなければならない．
+   * 並列領域内ではKeyManager::pool()がスレッドローカルなメモリプールを返すため，
+   * 各演算の作業領域の確保はスレッド間で競合しない．
+   */
+  template<class MsgType>
+  void encode(std::span<Plaintext<Impl>> out,
+              const std::vector<RawVec<MsgType>>& in,
+              const EncodingParams<Impl>& params) const {
+    batch(out.size(), in.size());
+    util::for_parallel([&](const size_t i){ encode(out[i], in[i], params); }, out.size());
+  }
+
+  template<class MsgType>
+  void decode(std::vector<RawVec<MsgType>>& out,
+              std::span<const Plaintext<Impl>> in) const {
+    out.resize(in.size());
+    util::for_parallel([&](const size_t i){ decode(out[i], in[i]); }, in.size());
+  }
+
+  void encrypt(std::span<Ciphertext<Impl>> out,
+               std::span<const Plaintext<Impl>> in) const {
+    batch(out.size(), in.size());
+    util::for_parallel([&](const size_t i){ encrypt(out[i], in[i]); }, out.size());
+  }
+
+  template<class MsgType>
+  void encode_and_encrypt(std::span<Ciphertext<Impl>> out,
+                          const std::vector<RawVec<MsgType>>& in,
+                          const EncodingParams<Impl>& params) const {
+    batch(out.size(), in.size());
+    util::for_parallel([&](const size_t i){ encode_and_encrypt(out[i], in[i], params); },
+                       out.size());
+  }
+
+  /// 復号器はスレッド間で共有せず，スレッドごとに用いる
+  void decrypt(std::span<Plaintext<Impl>> out,
+               std::span<const Ciphertext<Impl>> in);
+
+  template<class MsgType>
+  void decrypt_and_decode(std::vector<RawVec<MsgType>>& out,
+                          std::span<const Ciphertext<Impl>> in){
+    std::vector<Plaintext<Impl>> pts(in.size());
+    decrypt(pts, in);
+    decode(out, pts);
+  }
+
+#define BATCH_UNARY_OP(name)                                                    \
+  void name(std::span<Ciphertext<Impl>> out) const {                            \
+    util::for_parallel([&](const size_t i){ name(out[i]); }, out.size());       \
+  }                                                                             \
+  void name(std::span<Ciphertext<Impl>> out,                                    \
+            std::span<const Ciphertext<Impl>> in) const {                       \
+    batch(out.size(), in.size());                                               \
+    util::for_parallel([&](const size_t i){ name(out[i], in[i]); }, out.size()); \
+  }
+  BATCH_UNARY_OP(square)
+  BATCH_UNARY_OP(relinearize)
+  BATCH_UNARY_OP(rescale)
+#undef BATCH_UNARY_OP
+
+  void negate(std::span<Ciphertext<Impl>> out,
+              std::span<const Ciphertext<Impl>> in) const {
+    batch(out.size(), in.size());
+    util::for_parallel([&](const size_t i){ negate(out[i], in[i]); }, out.size());
+  }
+
+#define BATCH_BINARY_OP(name, InType)                                                    \
+  void name(std::span<Ciphertext<Impl>> out,                                             \
+            std::span<const InType<Impl>> in) const {                                    \
+    batch(out.size(), in.size());                                                        \
+    util::for_parallel([&](const size_t i){ name(out[i], in[i]); }, out.size());         \
+  }                                                                                      \
+  void name(std::span<Ciphertext<Impl>> out,                                             \
+            std::span<const Ciphertext<Impl>> in1,                                       \
+            std::span<const InType<Impl>> in2) const {                                   \
+    batch(out.size(), in1.size(), in2.size());                                           \
+    util::for_parallel([&](const size_t i){ name(out[i], in1[i], in2[i]); }, out.size()); \
+  }
+  BATCH_BINARY_OP(add, Ciphertext)
+  BATCH_BINARY_OP(add, Plaintext)
+  BATCH_BINARY_OP(sub, Ciphertext)
+  BATCH_BINARY_OP(sub, Plaintext)
+  BATCH_BINARY_OP(mul, Ciphertext)
+  BATCH_BINARY_OP(mul, Plaintext)
+#undef BATCH_BINARY_OP
+
+  void mod_down(std::span<Ciphertext<Impl>> out, const int n) const {
+    util::for_parallel([&](const size_t i){ mod_down(out[i], n); }, out.size());
+  }
+
+  void rotate(std::span<Ciphertext<Impl>> out, const int shift_count) const {
+    util::for_parallel([&](const size_t i){ rotate(out[i], shift_count); }, out.size());
+  }
+  ////////////////////////////////////////
+
+  
   /**
    * 複数の暗号文に対する総和や総積の一部分を実行するための関数
    */
@@ -424,6 +694,71 @@ public:
     }
   }
 
+  /**
+   * *out.at(i) = *in.at(0) op ... op *in.at(i)となるinclusive prefix scan（op_typeはaddかmul）
+   *
+   * 要素を複数のチャンクに分割し，(1) 各チャンク内のscan（並列），(2) チャンク末尾の値のscan，
+   * (3) 各チャンクへの先行チャンクの値の反映（並列），の順に計算する（演算回数は高々2n回）．
+   * 冪の列（in.at(i)が全て同じ）を各sub-keyの格納先に直接書き込む用途を想定している．
+   */
+  template<OpType op_type, class Type>
+  void scan(const std::vector<Type*>& out,
+            const std::vector<const Type*>& in) const {
+    static_assert(op_type == OpType::add || op_type == OpType::mul,
+                  "scan() supports only associative operations.");
+    const size_t n = in.size();
+    if( out.size() != n ){
+      throw std::invalid_argument("Sizes of out and in are mismatched.");
+    }
+    if( n == 0 ){ return; }
+
+    // スパン（2n/c + c）が最小となるようにチャンク数cを決める
+    const size_t num_chunks = std::clamp<size_t>(
+        static_cast<size_t>(std::sqrt(2.0 * n)), 1, std::max(1, omp_get_max_threads())
+    );
+    const size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+    auto chunk_begin = [&](const size_t c){ return std::min(n, c * chunk_size); };
+
+    // add/mulは可換なので，out op= inとして計算する
+    auto apply = [&](Type& out, const Type& in){
+      if constexpr( op_type == OpType::add ){
+        add(out, in);
+      }else{
+        mul(out, in);
+      }
+    };
+
+#pragma omp parallel for schedule(static, 1) num_threads(num_chunks)
+    for( size_t c = 0; c < num_chunks; ++c ){
+      const size_t b = chunk_begin(c), e = chunk_begin(c + 1);
+      if( b == e ){ continue; }
+      copy(*out.at(b), *in.at(b));
+      for( size_t i = b + 1; i < e; ++i ){
+        copy(*out.at(i), *out.at(i - 1));
+        apply(*out.at(i), *in.at(i));
+      }
+    }
+
+    for( size_t c = 1; c < num_chunks; ++c ){
+      const size_t b = chunk_begin(c), e = chunk_begin(c + 1);
+      if( b == e ){ break; }
+      apply(*out.at(e - 1), *out.at(b - 1));
+    }
+
+#pragma omp parallel for schedule(static, 1) num_threads(num_chunks)
+    for( size_t c = 1; c < num_chunks; ++c ){
+      const size_t b = chunk_begin(c), e = chunk_begin(c + 1);
+      for( size_t i = b; i + 1 < e; ++i ){
+        apply(*out.at(i), *out.at(b - 1));
+      }
+    }
+  }
+
+  /**
+   * 各stepについてout += rotate(out, step)を順に行い，総和をtarget_slot_idのスロットに集める．
+   * 連続する2つのstep a, bについて，a, b, a + bの回転の鍵が全て存在する場合は，
+   * out + rotate(out, a) + rotate(out, b) + rotate(out, a + b)としてrotate_many()で1度に計算する．
+   */
   void rotate_and_sum(Ciphertext<Impl>& out,
                       const size_t target_slot_id,
                       const std::vector<int>& rotate_steps) const;
@@ -441,7 +776,25 @@ public:
   
 
 private:
+  /// バッチ版の演算の引数の要素数を検査する
+  template<class ...Sizes>
+  static void batch(const size_t size, const Sizes... sizes){
+    if( ((sizes != size) || ...) ){
+      throw std::invalid_argument("Batch sizes mismatch.");
+    }
+  }
+
+  /// inのレベルからlevel_diffだけ下げたレベルでoutの領域を確保する（inが未確保の場合はレベルを指定しない）
+  template<class T>
+  void allocate_like(T& out, const Ciphertext<Impl>& in, const int level_diff = 0) const {
+    allocate(out, in.ptr() != nullptr ? in.level() - level_diff : -1, 0.0);
+  }
+
   std::shared_ptr<KeyManager<Impl>> key_manager_;
+
+  std::shared_ptr<ObjectPool<Impl>> object_pool_ = std::make_shared<ObjectPool<Impl>>();
+
+  std::shared_ptr<EncodeCache<Impl>> encode_cache_ = std::make_shared<EncodeCache<Impl>>();
   
   
 };
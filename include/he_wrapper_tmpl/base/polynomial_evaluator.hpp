@@ -0,0 +1,341 @@
+#pragma once
+
+#include<algorithm>
+#include<cmath>
+#include<map>
+#include<stdexcept>
+#include<utility>
+#include<vector>
+
+namespace he_wrapper_tmpl{
+/**
+ * 暗号化された係数をもつ多項式 p(x) = a_0 + a_1 x + ... + a_d x^d の評価器（ベースライン）
+ *
+ * baby-step giant-step の分割 p(x) = r(x) + x^g q(x)（gはp(x)の係数の数未満で最大の2のべき）を
+ * 再帰的に適用して評価する．
+ * - 暗号文同士の乗算は各分割で1回（計d回）とgiant step x^g の計算（floor(log2 d)回）のみ
+ *   （係数が暗号文であるため，Paterson–Stockmeyer法のbaby step側の節約は生じない）
+ * - 乗算の深さは ceil(log2(d+1))（最適）
+ * - r(x)は積 x^g q(x) のrelinearize・rescaleの前に加算し，relinearize・rescaleの回数を減らす
+ * 各係数の暗号文のlevel・scaleはplan()で求め，mod_downによるlevelの調整，relinearize，rescaleは
+ * evaluate()で自動的に挿入する．
+ */
+template<template<class> class Impl>
+class PolynomialEvaluator{
+public:
+  explicit PolynomialEvaluator(const size_t degree) : degree_(degree){
+    if( degree == 0 ){
+      throw std::invalid_argument("Degree of polynomial must be positive.");
+    }
+    root_ = build(0, degree + 1);
+  }
+  ~PolynomialEvaluator() = default;
+  PolynomialEvaluator(const PolynomialEvaluator&) = default;
+  PolynomialEvaluator(PolynomialEvaluator&&) noexcept = default;
+
+  PolynomialEvaluator& operator=(const PolynomialEvaluator&) = default;
+  PolynomialEvaluator& operator=(PolynomialEvaluator&&) noexcept = default;
+
+  size_t degree() const noexcept { return degree_; }
+
+  /// 乗算の深さ
+  size_t depth() const noexcept { return num_powers(); }
+
+  /// 暗号文同士の乗算の回数（giant stepの計算を含む）
+  size_t num_nonscalar_muls() const noexcept { return degree_ + num_powers() - 1; }
+
+  /**
+   * xのエンコードパラメータx_epから，各係数a_iの暗号文のエンコードパラメータを求める（HE演算は行わない）．
+   * 評価結果はrelinearize・rescaleを行わない暗号文となり，そのscaleはx_ep.scale * (x^g のscale)である．
+   */
+  const std::vector<EncodingParams<Impl>>& plan(const Operator<Impl>& op,
+                                                const EncodingParams<Impl>& x_ep){
+    learn_modulus_chain(op, x_ep);
+
+    power_levels_.assign(num_powers(), top_level_);
+    power_scales_.assign(num_powers(), x_ep.scale);
+    EncodingParams<Impl> power_ep = x_ep;
+    for( size_t j = 1; j < num_powers(); ++j ){
+      if( power_levels_.at(j-1) < 1 ){
+        throw std::invalid_argument("Levels are insufficient for the polynomial.");
+      }
+      op.square(power_ep);
+      op.rescale(power_ep);
+      power_levels_.at(j) = op.level(power_ep);
+      power_scales_.at(j) = power_ep.scale;
+    }
+
+    const auto& root = nodes_.at(root_);
+    const int level = natural_raw_level(root_);
+    if( level < 0 ){
+      throw std::invalid_argument("Levels are insufficient for the polynomial.");
+    }
+    coeff_eps_.assign(degree_ + 1, EncodingParams<Impl>());
+    assign_raw(root_, level, x_ep.scale * power_scales_.at(root.power));
+    return coeff_eps_;
+  }
+
+  const auto& coeff_encoding_params() const noexcept { return coeff_eps_; }
+
+  /// 評価結果のエンコードパラメータ（plan()の後に有効）
+  EncodingParams<Impl> result_encoding_params() const {
+    const auto& root = nodes_.at(root_);
+    return EncodingParams<Impl>(level_eps_.at(root.level)).set_scale(root.scale);
+  }
+
+  /**
+   * out = coeffs[0] + coeffs[1] x + ... + coeffs[d] x^d
+   * xおよび各係数はplan()で求めたエンコードパラメータで暗号化されていなければならない．
+   * outはrelinearize・rescaleを行わない．
+   */
+  void evaluate(const Operator<Impl>& op, Ciphertext<Impl>& out, const Ciphertext<Impl>& x,
+                const std::vector<const Ciphertext<Impl>*>& coeffs) const {
+    if( coeff_eps_.empty() ){
+      throw std::logic_error("PolynomialEvaluator::plan() has not been called.");
+    }
+    if( coeffs.size() != degree_ + 1 ){
+      throw std::invalid_argument("The number of coefficients does not match the degree.");
+    }
+    check(x, top_level_, power_scales_.at(0));
+    for( size_t i = 0; i <= degree_; ++i ){
+      check(*coeffs.at(i), level_of(coeff_eps_.at(i)), coeff_eps_.at(i).scale);
+    }
+
+    // 一時的な暗号文はop.object_pool()から借り，繰り返し評価する場合は領域を再利用する
+    State state{op, x, coeffs, {}};
+    const bool aliased = std::any_of(coeffs.begin(), coeffs.end(),
+                                     [&](const auto* c){ return c->ptr() == out.ptr(); });
+    if( out.ptr() != nullptr && (out.ptr() == x.ptr() || aliased) ){
+      Ciphertext<Impl> tmp;
+      eval_raw(state, root_, tmp);
+      out = std::move(tmp);
+    }else{
+      eval_raw(state, root_, out);
+    }
+  }
+
+private:
+  /**
+   * 係数a_lo, ..., a_{lo+num_coeffs-1}をもつ部分多項式
+   * 葉（num_coeffs == 1）は係数の暗号文そのものを表す．
+   */
+  struct Node{
+    size_t lo;
+    size_t num_coeffs;
+    /// giant stepの指数の対数（x^{2^power}）
+    size_t power = 0;
+    /// x^g q(x) の q(x)
+    int high = -1;
+    /// r(x)
+    int low = -1;
+    /// 出力のlevelとscale（葉以外はrescale前の値）
+    int level = 0;
+    double scale = 0.0;
+
+    bool is_leaf() const noexcept { return num_coeffs == 1; }
+  };
+
+  struct State{
+    const Operator<Impl>& op;
+    const Ciphertext<Impl>& x;
+    const std::vector<const Ciphertext<Impl>*>& coeffs;
+    /// (giant stepの指数の対数, level) -> x^{2^power}
+    std::map<std::pair<size_t, int>, typename ObjectPool<Impl>::template Lease<Ciphertext<Impl>>> powers;
+  };
+
+  /// 相対誤差がこの値以下のscaleは同一とみなし，計画した値にそろえる
+  static constexpr double scale_tolerance = 1e-9;
+
+  size_t num_powers() const noexcept {
+    size_t out = 1;
+    while( (size_t(1) << out) <= degree_ ){ ++out; }
+    return out;
+  }
+
+  int build(const size_t lo, const size_t num_coeffs){
+    const int id = nodes_.size();
+    nodes_.emplace_back();
+    nodes_.back().lo = lo;
+    nodes_.back().num_coeffs = num_coeffs;
+    if( num_coeffs == 1 ){ return id; }
+
+    size_t power = 0;
+    while( (size_t(1) << (power + 1)) < num_coeffs ){ ++power; }
+    const size_t g = size_t(1) << power;
+    const int low = build(lo, g);
+    const int high = build(lo + g, num_coeffs - g);
+    nodes_.at(id).power = power;
+    nodes_.at(id).low = low;
+    nodes_.at(id).high = high;
+    return id;
+  }
+
+  /**
+   * 各levelのエンコードパラメータとrescaleで除される素数を求める．
+   * （エンコードパラメータの追跡のみで求め，HE演算は行わない）
+   */
+  void learn_modulus_chain(const Operator<Impl>& op, const EncodingParams<Impl>& x_ep){
+    EncodingParams<Impl> ep = x_ep;
+    top_level_ = op.level(ep);
+    level_eps_.assign(top_level_ + 1, EncodingParams<Impl>());
+    primes_.assign(top_level_ + 1, 0.0);
+    for( int level = top_level_; level >= 0; --level ){
+      level_eps_.at(level) = ep;
+      if( level == 0 ){ break; }
+      EncodingParams<Impl> rescaled = ep;
+      op.rescale(rescaled);
+      primes_.at(level) = ep.scale / rescaled.scale;
+      op.mod_down(ep, 1);
+    }
+  }
+
+  int level_of(const EncodingParams<Impl>& ep) const {
+    for( int level = 0; level <= top_level_; ++level ){
+      if( level_eps_.at(level).parms_id == ep.parms_id ){ return level; }
+    }
+    throw std::invalid_argument("Unknown encoding parameters.");
+  }
+
+  /// rescale後の出力として取りうる最大のlevel
+  int natural_level(const int id) const {
+    const auto& node = nodes_.at(id);
+    return node.is_leaf() ? top_level_ : natural_raw_level(id) - 1;
+  }
+
+  /// rescale前の出力として取りうる最大のlevel
+  int natural_raw_level(const int id) const {
+    const auto& node = nodes_.at(id);
+    if( node.is_leaf() ){ return top_level_; }
+    return std::min({natural_level(node.high),
+                     power_levels_.at(node.power),
+                     natural_raw_level(node.low)});
+  }
+
+  /// nodeの出力をrescale後にlevel，scaleとなるよう計画する
+  void assign(const int id, const int level, const double scale){
+    auto& node = nodes_.at(id);
+    if( node.is_leaf() ){
+      node.level = level;
+      node.scale = scale;
+      coeff_eps_.at(node.lo) = level_eps_.at(level);
+      coeff_eps_.at(node.lo).set_scale(scale);
+      return;
+    }
+    assign_raw(id, level + 1, scale * primes_.at(level + 1));
+  }
+
+  /// nodeの出力をrescale前にlevel，scaleとなるよう計画する
+  void assign_raw(const int id, const int level, const double scale){
+    auto& node = nodes_.at(id);
+    node.level = level;
+    node.scale = scale;
+    assign(node.high, level, scale / power_scales_.at(node.power));
+    const auto& low = nodes_.at(node.low);
+    if( low.is_leaf() ){
+      assign(node.low, level, scale);
+    }else{
+      assign_raw(node.low, level, scale);
+    }
+  }
+
+  void check(const Ciphertext<Impl>& in, const int level, const double scale) const {
+    if( in.level() != level || !is_close(in.scale(), scale) ){
+      throw std::invalid_argument("Ciphertext is not encrypted with the planned encoding parameters.");
+    }
+  }
+
+  static bool is_close(const double a, const double b) noexcept {
+    return std::abs(a - b) <= scale_tolerance * std::max(std::abs(a), std::abs(b));
+  }
+
+  /// 丸め誤差によるscaleのずれを計画した値にそろえる
+  static void align_scale(Ciphertext<Impl>& inout, const double scale){
+    const double current = inout.scale();
+    if( !is_close(current, scale) ){
+      throw std::logic_error("Scale deviates from the plan.");
+    }
+    if( current != scale ){
+      inout.scale(scale);
+    }
+  }
+
+  /// levelにそろえた x^{2^power}
+  const Ciphertext<Impl>& power(State& state, const size_t power, const int level) const {
+    if( power == 0 && level == top_level_ ){ return state.x; }
+    auto itr = state.powers.find({power, level});
+    if( itr != state.powers.end() ){ return *itr->second; }
+
+    const int natural = power_levels_.at(power);
+    auto out = state.op.lease_ciphertext(level == natural ? level + 1 : level);
+    if( level == natural ){
+      const auto& prev = this->power(state, power - 1, power_levels_.at(power - 1));
+      state.op.square(*out, prev);
+      state.op.relinearize(*out);
+      state.op.rescale(*out);
+      align_scale(*out, power_scales_.at(power));
+    }else{
+      state.op.mod_down(*out, this->power(state, power, natural), natural - level);
+    }
+    return *state.powers.emplace(std::make_pair(power, level), std::move(out)).first->second;
+  }
+
+  void eval(State& state, const int id, Ciphertext<Impl>& out) const {
+    const auto& node = nodes_.at(id);
+    if( node.is_leaf() ){
+      state.op.copy(out, *state.coeffs.at(node.lo));
+      return;
+    }
+    eval_raw(state, id, out);
+    state.op.relinearize(out);
+    state.op.rescale(out);
+    align_scale(out, nodes_.at(id).scale / primes_.at(node.level));
+  }
+
+  /// out = r(x) + x^g q(x)（relinearize・rescaleを行わない）
+  void eval_raw(State& state, const int id, Ciphertext<Impl>& out) const {
+    const auto& node = nodes_.at(id);
+    const auto& high = nodes_.at(node.high);
+    const auto& giant = power(state, node.power, node.level);
+    if( high.is_leaf() ){
+      state.op.mul(out, *state.coeffs.at(high.lo), giant);
+    }else{
+      eval(state, node.high, out);
+      state.op.mul(out, giant);
+    }
+    align_scale(out, node.scale);
+
+    const auto& low = nodes_.at(node.low);
+    if( low.is_leaf() ){
+      state.op.add(out, *state.coeffs.at(low.lo));
+    }else{
+      auto tmp = state.op.lease_ciphertext(low.level);
+      eval_raw(state, node.low, *tmp);
+      state.op.add(out, *tmp);
+    }
+  }
+
+  size_t degree_;
+
+  int root_ = 0;
+
+  std::vector<Node> nodes_;
+
+  int top_level_ = 0;
+
+  /// 各levelのエンコードパラメータ
+  std::vector<EncodingParams<Impl>> level_eps_;
+
+  /// 各levelからrescaleする際に除される素数
+  std::vector<double> primes_;
+
+  /// x^{2^j} のlevelとscale
+  std::vector<int> power_levels_;
+  std::vector<double> power_scales_;
+
+  /// 各係数のエンコードパラメータ
+  std::vector<EncodingParams<Impl>> coeff_eps_;
+
+};
+
+
+}  // namespace he_wrapper_tmpl
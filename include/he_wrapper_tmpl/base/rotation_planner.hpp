@@ -0,0 +1,281 @@
+#pragma once
+
+#include<algorithm>
+#include<cstdlib>
+#include<map>
+#include<optional>
+#include<set>
+#include<stdexcept>
+#include<utility>
+#include<vector>
+
+namespace he_wrapper_tmpl{
+/**
+ * 生成するGalois鍵の集合と，鍵が直接存在しない回転の分解
+ *
+ * 回転量はスロット数を法として(-num_slots / 2, num_slots / 2]の代表元に正規化して扱う．
+ * 鍵が直接存在しない回転は，decompose()が返す回転の列（いずれも鍵が存在する）を順に適用して計算する．
+ */
+class RotationPlan{
+public:
+  RotationPlan(){}
+  RotationPlan(const int num_slots, const std::set<int>& keys, const size_t cost)
+    : num_slots_(num_slots), keys_(keys.cbegin(), keys.cend()), cost_(cost){}
+  virtual ~RotationPlan() = default;
+  RotationPlan(const RotationPlan&) = default;
+  RotationPlan(RotationPlan&&) noexcept = default;
+
+  RotationPlan& operator=(const RotationPlan&) = default;
+  RotationPlan& operator=(RotationPlan&&) noexcept = default;
+
+  /// 生成する鍵の回転量（昇順）
+  const std::vector<int>& keys() const noexcept { return keys_; }
+  size_t num_keys() const noexcept { return keys_.size(); }
+  bool empty() const noexcept { return keys_.empty(); }
+
+  /// 登録した回転を全てこの計画で計算した場合の回転の総数（重み付き）
+  size_t cost() const noexcept { return cost_; }
+
+  bool has_key(const int shift_count) const {
+    return !empty() && std::binary_search(keys_.cbegin(), keys_.cend(), normalize(shift_count, num_slots_));
+  }
+
+  /**
+   * shift_countの回転を鍵の存在する回転の列に分解する．
+   * 鍵が直接存在する場合はその回転のみ，そうでなければNAFと2進展開のうち短い方を返す
+   * （いずれの項の鍵もそろわない場合や，回転量が0の場合は空）．
+   */
+  std::vector<int> decompose(const int shift_count) const {
+    if( empty() ){ return {}; }
+    const int r = normalize(shift_count, num_slots_);
+    if( r == 0 ){ return {}; }
+    if( has_key(r) ){ return {r}; }
+
+    std::optional<std::vector<int>> out;
+    for( const bool use_naf : {true, false} ){
+      auto terms = split(r, num_slots_, use_naf);
+      const bool available = std::all_of(terms.cbegin(), terms.cend(),
+                                         [&](const int t){ return has_key(t); });
+      if( available && (!out || terms.size() < out->size()) ){ out = std::move(terms); }
+    }
+    return out.value_or(std::vector<int>{});
+  }
+
+  /// shift_countを(-num_slots / 2, num_slots / 2]に正規化する
+  static int normalize(const int shift_count, const int num_slots){
+    int r = shift_count % num_slots;
+    if( r < 0 ){ r += num_slots; }
+    return (2 * r > num_slots ? r - num_slots : r);
+  }
+
+  /**
+   * 正規化済みの回転量rを2べきの回転の和に分解する．
+   * use_naf == trueの場合はNAF（SEALが鍵のない回転に用いる分解と同じ，±2^kの項），
+   * falseの場合はr mod num_slotsの2進展開（2^kの項のみ）とする．各項も正規化し，0となる項は除く．
+   */
+  static std::vector<int> split(const int r, const int num_slots, const bool use_naf){
+    std::vector<int> out;
+    if( use_naf ){
+      int value = std::abs(r);
+      for( int i = 0; value != 0; ++i ){
+        const int z = ((value & 1) ? 2 - (value & 3) : 0);
+        value = (value - z) >> 1;
+        if( z != 0 ){ out.push_back(normalize((r < 0 ? -z : z) * (1 << i), num_slots)); }
+      }
+    }else{
+      const int value = (r < 0 ? r + num_slots : r);
+      for( int i = 0; (value >> i) != 0; ++i ){
+        if( (value >> i) & 1 ){ out.push_back(normalize(1 << i, num_slots)); }
+      }
+    }
+    out.erase(std::remove(out.begin(), out.end(), 0), out.end());
+    return out;
+  }
+
+private:
+  int num_slots_ = 0;
+
+  std::vector<int> keys_;
+
+  size_t cost_ = 0;
+
+};
+
+
+/**
+ * ワークロードが用いる回転を集め，鍵の数（メモリ量）の上限のもとで生成するGalois鍵を決める．
+ *
+ * 登録した回転のうち回転の削減量（重み × (分解の項数 - 1)）の大きいものから順に鍵を直接生成し，
+ * 残りの回転はNAFもしくは2進展開の項の鍵で分解する．
+ * rotate_and_sumの連続する2つのstep a, bの和a + bの鍵（add_rotate_and_sum()でhoist_pairs == trueの場合）は，
+ * rotate_many()で鍵交換の分解を共有するためのもので鍵交換の回数は減らないため，回転の鍵を決めた後に
+ * 上限に余裕がある場合のみ，a, bの鍵がともに存在する組について生成する．
+ * 鍵の数とrotation（鍵交換）の回数はトレードオフの関係にあり，上限が小さいほど分解による回転が増える．
+ *
+ * 例：
+ *   RotationPlanner planner(km->num_slots());
+ *   planner.add_rotate_and_sum(0, {1, 2, 4, 8});
+ *   km->enable_glk(planner.plan_for_memory(budget, km->galois_key_bytes()));
+ */
+class RotationPlanner{
+public:
+  explicit RotationPlanner(const int num_slots) : num_slots_(num_slots){
+    if( num_slots <= 0 ){
+      throw std::invalid_argument("num_slots must be positive");
+    }
+  }
+
+  /// shift_countの回転をweight回用いることを登録する
+  RotationPlanner& add(const int shift_count, const size_t weight = 1){
+    const int r = RotationPlan::normalize(shift_count, num_slots_);
+    if( r != 0 && weight > 0 ){ weights_[r] += weight; }
+    return *this;
+  }
+
+  RotationPlanner& add(const std::vector<int>& shift_counts, const size_t weight = 1){
+    for( const int s : shift_counts ){ add(s, weight); }
+    return *this;
+  }
+
+  /**
+   * Operator::rotate_and_sum(out, target_slot_id, rotate_steps)が用いる回転を登録する．
+   * hoist_pairs == trueの場合は，rotate_many()でまとめて計算する2つのstepの組も登録する．
+   */
+  RotationPlanner& add_rotate_and_sum(const size_t target_slot_id,
+                                      const std::vector<int>& rotate_steps,
+                                      const size_t weight = 1,
+                                      const bool hoist_pairs = false){
+    auto signed_step = [&](const int step){
+      return ((step & target_slot_id) == 0 ? step : -step);
+    };
+    size_t covered = 0;
+    for( const int step : rotate_steps ){
+      add(signed_step(step), weight);
+      covered |= static_cast<size_t>(step);
+    }
+    // rotate_and_sumがrotate_many()でまとめる組（先頭から2つずつ）
+    for( size_t i = 0; hoist_pairs && i + 1 < rotate_steps.size(); i += 2 ){
+      add_pair(signed_step(rotate_steps[i]), signed_step(rotate_steps[i + 1]), weight);
+    }
+    if( target_slot_id != (covered & target_slot_id) ){
+      add(-static_cast<int>(target_slot_id), weight);
+    }
+    return *this;
+  }
+
+  /**
+   * 回転a, bをrotate_many()でまとめて計算する組をweight回用いることを登録する．
+   * a, bの回転自体は別途add()で登録する．組の和の鍵は，plan()で上限に余裕がある場合のみ生成する．
+   */
+  RotationPlanner& add_pair(const int a, const int b, const size_t weight = 1){
+    const int ra = RotationPlan::normalize(a, num_slots_);
+    const int rb = RotationPlan::normalize(b, num_slots_);
+    const int sum = RotationPlan::normalize(a + b, num_slots_);
+    if( ra != 0 && rb != 0 && sum != 0 && weight > 0 ){
+      pair_weights_[{std::min(ra, rb), std::max(ra, rb)}] += weight;
+    }
+    return *this;
+  }
+
+  /// 登録した回転と重み
+  const std::map<int, size_t>& weights() const noexcept { return weights_; }
+
+  /// 登録した組と重み
+  const std::map<std::pair<int, int>, size_t>& pair_weights() const noexcept { return pair_weights_; }
+
+  /**
+   * 鍵の数をmax_keys以下として，回転の総数（重み付き）が小さくなる計画を貪欲法で求める．
+   * 分解の項の鍵だけでもmax_keysを超える場合は例外を投げる．
+   */
+  RotationPlan plan(const size_t max_keys) const {
+    std::optional<RotationPlan> best;
+    for( const bool use_naf : {true, false} ){
+      std::set<int> direct, keys;
+      size_t cost = evaluate(direct, use_naf, keys);
+      if( keys.size() > max_keys ){ continue; }
+
+      // 回転の削減量の大きい順に，鍵を直接生成する回転を追加する
+      std::vector<std::pair<size_t, int>> candidates;
+      for( const auto& [r, w] : weights_ ){
+        const size_t saving = w * (RotationPlan::split(r, num_slots_, use_naf).size() - 1);
+        if( saving > 0 ){ candidates.emplace_back(saving, r); }
+      }
+      std::stable_sort(candidates.begin(), candidates.end(),
+                       [](const auto& a, const auto& b){ return a.first > b.first; });
+      for( const auto& [saving, r] : candidates ){
+        std::set<int> trial = direct, trial_keys;
+        trial.insert(r);
+        const size_t trial_cost = evaluate(trial, use_naf, trial_keys);
+        if( trial_keys.size() <= max_keys && trial_cost < cost ){
+          direct = std::move(trial);
+          keys = std::move(trial_keys);
+          cost = trial_cost;
+        }
+      }
+
+      if( !best || cost < best->cost() || (cost == best->cost() && keys.size() < best->num_keys()) ){
+        best = RotationPlan(num_slots_, keys, cost);
+      }
+    }
+    if( !best ){
+      throw std::invalid_argument("max_keys is too small to generate the rotation steps");
+    }
+    return add_pair_keys(*best, max_keys);
+  }
+
+  /// 鍵の総量をmemory_budgetバイト以下とする計画（key_bytesは鍵1つあたりのバイト数）
+  RotationPlan plan_for_memory(const size_t memory_budget, const size_t key_bytes) const {
+    if( key_bytes == 0 ){
+      throw std::invalid_argument("key_bytes must be positive");
+    }
+    return plan(memory_budget / key_bytes);
+  }
+
+private:
+  /// directの回転は鍵を直接生成し，それ以外を分解する場合の鍵の集合と回転の総数
+  size_t evaluate(const std::set<int>& direct, const bool use_naf, std::set<int>& keys) const {
+    keys = direct;
+    size_t cost = 0;
+    for( const auto& [r, w] : weights_ ){
+      if( direct.count(r) > 0 ){
+        cost += w;
+        continue;
+      }
+      const auto terms = RotationPlan::split(r, num_slots_, use_naf);
+      keys.insert(terms.cbegin(), terms.cend());
+      cost += w * terms.size();
+    }
+    return cost;
+  }
+
+  /**
+   * 鍵の数がmax_keysを超えない範囲で，a, bの鍵がともに存在する組の和の鍵を重みの大きい順に加える．
+   * 回転の鍵の選択より後に行うため，組の鍵が分解の回転を減らす鍵を押しのけることはない．
+   */
+  RotationPlan add_pair_keys(const RotationPlan& plan, const size_t max_keys) const {
+    std::vector<std::pair<size_t, int>> candidates;
+    for( const auto& [ab, w] : pair_weights_ ){
+      if( plan.has_key(ab.first) && plan.has_key(ab.second) ){
+        candidates.emplace_back(w, RotationPlan::normalize(ab.first + ab.second, num_slots_));
+      }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const auto& a, const auto& b){ return a.first > b.first; });
+    std::set<int> keys(plan.keys().cbegin(), plan.keys().cend());
+    for( const auto& [w, sum] : candidates ){
+      if( keys.size() >= max_keys ){ break; }
+      keys.insert(sum);
+    }
+    return RotationPlan(num_slots_, keys, plan.cost());
+  }
+
+  int num_slots_;
+
+  std::map<int, size_t> weights_;
+
+  std::map<std::pair<int, int>, size_t> pair_weights_;
+
+};
+
+
+}  // namespace he_wrapper_tmpl
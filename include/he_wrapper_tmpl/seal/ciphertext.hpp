@@ -17,22 +17,41 @@ public:
 
   auto& ptr() noexcept { return data_; }
   const auto& ptr() const noexcept { return data_; }
-  auto& ref() noexcept { return *data_; }
+  /**
+   * 書き込み用の参照．
+   * 領域が他の暗号文と共有されている場合（copy-on-write）は，先に複製して共有を解く．
+   * 読み出しのみの場合はcref()を用いる．
+   */
+  auto& ref(){
+    detach();
+    return *data_;
+  }
   const auto& ref() const noexcept { return *data_; }
   const auto& cref() const noexcept { return *data_; }
   
   size_t size() const { return cref().size(); }
   int level() const { return cref().coeff_modulus_size() - 1; }
   int num_moduli() const { return cref().coeff_modulus_size(); }
-  void scale(const double s){ ref().scale() = s; }
-  double& scale(){ return ref().scale(); }
+  /// scaleの読み出しは共有を解かない（書き込みはscale(s)で行う）
   double scale() const { return cref().scale(); }
+  void scale(const double s){ ref().scale() = s; }
 
-  /// @note 現状，levelは反映されるようには実装していない
+  /**
+   * km.data_pool()から領域を確保する．
+   * levelが有効な場合は，そのレベルで乗算結果（成分数3）まで再確保なしに格納できる容量を確保する．
+   * levelが負の場合は容量を確保しない（最初の演算で確保される）．
+   * 他の暗号文と共有している領域は出力で上書きされるため，複製せずに手放して新たに確保する．
+   */
   void allocate(const KeyManager<ImplSeal>& km, const int level, const double scale){
+    release_shared();
     if( data_ != nullptr ){ return; }
-    data_ = std::make_shared<::seal::Ciphertext>();
-    this->scale() = scale;
+    if( const auto context_data = km.context_data(level) ){
+      data_ = std::make_shared<::seal::Ciphertext>(km.context(), context_data->parms_id(),
+                                                   3, km.data_pool());
+    }else{
+      data_ = std::make_shared<::seal::Ciphertext>(km.data_pool());
+    }
+    data_->scale() = scale;
   }
 
   void allocate(const KeyManager<ImplSeal>& km){
@@ -68,6 +87,31 @@ public:
     data_ = nullptr;
   }
 
+  auto data(){ return ref().data(); }
+  auto data() const noexcept { return cref().data(); }
+
+  /// ep.parms_idのmoduliで多項式size個分の領域を確保する（NTT形式，内容は上書きされる前提とする）
+  void resize(const KeyManager<ImplSeal>& km, const EncodingParams<ImplSeal>& ep,
+              const size_t size){
+    release_shared();
+    if( data_ == nullptr ){
+      data_ = std::make_shared<DataType>(km.data_pool());
+    }
+    data_->scale() = ep.scale;
+    data_->resize(km.context(), ep.parms_id, size);
+    data_->is_ntt_form() = true;
+  }
+
+  /// ep.parms_idのmoduliで多項式size個分まで再確保せずに拡張できるよう，容量を確保する
+  void reserve(const KeyManager<ImplSeal>& km, const EncodingParams<ImplSeal>& ep,
+               const size_t size){
+    if( data_ == nullptr ){
+      allocate(km, -1, ep.scale);
+    }
+    detach();
+    data_->reserve(km.context(), ep.parms_id, size);
+  }
+
   void set_data(std::vector<uint64_t>&& vec, const KeyManager<ImplSeal>& km,
                 const EncodingParams<ImplSeal>& ep){
     const auto& moduli = km.context().get_context_data(ep.parms_id)->parms().coeff_modulus();
@@ -76,13 +120,24 @@ public:
     if( size * t != vec.size() ){
       throw std::invalid_argument("Invalid size of vector for Ciphertext.");
     }
-    scale() = ep.scale;
-    data_->resize(km.context(), ep.parms_id, size);
+    resize(km, ep, size);
     std::copy(vec.begin(), vec.end(), data_->data());
-    data_->is_ntt_form() = true;
   }
   
+  /// 領域が他の暗号文と共有されている場合は複製し，この暗号文が専有するようにする
+  void detach(){
+    if( data_ == nullptr || data_.use_count() == 1 ){ return; }
+    auto copied = std::make_shared<DataType>(data_->pool());
+    *copied = *data_;
+    data_ = std::move(copied);
+  }
+
 private:
+  /// 領域が他の暗号文と共有されている場合は，複製せずに手放す（直後に上書きする場合に用いる）
+  void release_shared() noexcept {
+    if( data_ != nullptr && data_.use_count() > 1 ){ data_ = nullptr; }
+  }
+
   std::shared_ptr<DataType> data_ = nullptr;
 
 };
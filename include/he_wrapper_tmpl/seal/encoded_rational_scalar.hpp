@@ -0,0 +1,48 @@
+#pragma once
+
+#include<vector>
+
+#include"seal/util/uintarithsmallmod.h"
+
+namespace he_wrapper_tmpl{
+/**
+ * エンコード済みの有理数スカラー（Operator::encode()で生成する）
+ *
+ * 最上位レベルの各modulusについて，スカラーの剰余とShoupの乗算用の前計算値を保持する．
+ * 下位レベルの暗号文・平文には先頭のmoduliに対応する値を用いるため，
+ * 1度エンコードすれば任意のレベルに繰り返しかけることができる．
+ */
+template<>
+class EncodedRationalScalar<ImplSeal>{
+public:
+  using Operand = ::seal::util::MultiplyUIntModOperand;
+
+  EncodedRationalScalar(){}
+  EncodedRationalScalar(std::vector<Operand>&& operands, const double scale)
+    : operands_(std::move(operands)), scale_(scale){}
+  virtual ~EncodedRationalScalar() = default;
+  EncodedRationalScalar(const EncodedRationalScalar&) = default;
+  EncodedRationalScalar(EncodedRationalScalar&&) noexcept = default;
+
+  EncodedRationalScalar& operator=(const EncodedRationalScalar&) = default;
+  EncodedRationalScalar& operator=(EncodedRationalScalar&&) noexcept = default;
+
+  /// 第i modulusでのスカラーの剰余（Shoupの前計算値を含む）
+  const Operand& operand(const size_t i) const { return operands_.at(i); }
+  const auto& operands() const noexcept { return operands_; }
+  size_t num_moduli() const noexcept { return operands_.size(); }
+
+  /// かけた暗号文・平文のscaleに乗じる値
+  double scale() const noexcept { return scale_; }
+
+  bool empty() const noexcept { return operands_.empty(); }
+
+private:
+  std::vector<Operand> operands_;
+
+  double scale_ = 0.0;
+
+};
+
+
+}  // namespace he_wrapper_tmpl
@@ -14,6 +14,8 @@ struct EncodingParams<ImplSeal>{
   EncodingParams& operator=(const EncodingParams&) = default;
   EncodingParams& operator=(EncodingParams&&) = default;
 
+  bool operator==(const EncodingParams&) const = default;
+
   EncodingParams<ImplSeal>& configure(const Plaintext<ImplSeal>& in);
   EncodingParams<ImplSeal>& configure(const Ciphertext<ImplSeal>& in);
 
@@ -0,0 +1,239 @@
+#pragma once
+
+#include<vector>
+
+#include"seal/util/uintarith.h"
+#include"seal/util/uintarithsmallmod.h"
+
+/**
+ * Operator<ImplSeal>の独自演算で用いるRNS limb単位のカーネル
+ */
+namespace he_wrapper_tmpl::kernel{
+/**
+ * Montgomeryの同時逆元計算（simultaneous inversion）により，out[j] = in[j]^{-1} mod qを計算する．
+ *
+ * num_lanes本の独立な累積積の列を交互に並べて処理することで，limb全体の逆元を
+ * num_lanes回のべき乗計算（Fermatの小定理，qは素数）と3n回程度の乗算で求める．
+ * in[j] == 0の場合はout[j] = 0とする．outとinは同じ領域でもよい．
+ */
+inline void batch_invert(uint64_t* out, const uint64_t* in, const size_t n,
+                         const ::seal::Modulus& modulus){
+  using ::seal::util::multiply_uint_mod;
+  constexpr size_t num_lanes = 8;
+
+  const size_t lanes = (n % num_lanes == 0 ? num_lanes : 1);
+  const size_t rows = n / lanes;
+  if( rows == 0 ){ return; }
+
+  auto nonzero = [](const uint64_t v){ return (v == 0 ? uint64_t{1} : v); };
+
+  // 各laneの累積積
+  std::vector<uint64_t> prefix(n);
+  for( size_t c = 0; c < lanes; ++c ){
+    prefix[c] = nonzero(in[c]);
+  }
+  for( size_t r = 1; r < rows; ++r ){
+    const size_t base = r * lanes;
+#pragma omp simd
+    for( size_t c = 0; c < lanes; ++c ){
+      prefix[base + c] = multiply_uint_mod(prefix[base - lanes + c], nonzero(in[base + c]), modulus);
+    }
+  }
+
+  // 各laneの総積の逆元のみをべき乗で求める
+  uint64_t inv[num_lanes];
+  for( size_t c = 0; c < lanes; ++c ){
+    inv[c] = ::seal::util::exponentiate_uint_mod(prefix[(rows - 1) * lanes + c],
+                                                 modulus.value() - 2, modulus);
+  }
+
+  // 後ろから各要素の逆元を復元する
+  for( size_t r = rows - 1; r > 0; --r ){
+    const size_t base = r * lanes;
+#pragma omp simd
+    for( size_t c = 0; c < lanes; ++c ){
+      const uint64_t v = in[base + c];
+      out[base + c] = (v == 0 ? 0 : multiply_uint_mod(inv[c], prefix[base - lanes + c], modulus));
+      inv[c] = multiply_uint_mod(inv[c], nonzero(v), modulus);
+    }
+  }
+  for( size_t c = 0; c < lanes; ++c ){
+    out[c] = (in[c] == 0 ? 0 : inv[c]);
+  }
+}
+
+
+/**
+ * out[j] = (in1[j] * in2[j] + in3[j]) mod qを1パスで計算する．
+ *
+ * 積と和を128bitのまま足し合わせてからBarrett reductionを1回だけ適用する
+ * （in1, in2, in3 < q < 2^61なので桁あふれしない）．outはin1またはin3と同じ領域でもよい．
+ */
+inline void multiply_add(uint64_t* out, const uint64_t* in1, const uint64_t* in2,
+                         const uint64_t* in3, const size_t n, const ::seal::Modulus& modulus){
+#pragma omp simd
+  for( size_t j = 0; j < n; ++j ){
+    unsigned long long z[2];
+    ::seal::util::multiply_uint64(in1[j], in2[j], z);
+    z[0] += in3[j];
+    z[1] += (z[0] < in3[j]);
+    out[j] = ::seal::util::barrett_reduce_128(z, modulus);
+  }
+}
+
+
+/**
+ * out[j] = in[j] * scalar mod qを計算する（Shoupの乗算）．
+ *
+ * scalarの前計算値（floor(scalar * 2^64 / q)）を用いて，128bitの積の上位語1回と下位語の乗算のみで
+ * [0, 2q)に落とし，条件付きの減算で正規化する．outはinと同じ領域でもよい．
+ */
+inline void multiply_scalar(uint64_t* out, const uint64_t* in, const size_t n,
+                            const ::seal::util::MultiplyUIntModOperand& scalar,
+                            const ::seal::Modulus& modulus){
+  const uint64_t q = modulus.value();
+#pragma omp simd
+  for( size_t j = 0; j < n; ++j ){
+    unsigned long long hi;
+    ::seal::util::multiply_uint64_hw64(in[j], scalar.quotient, &hi);
+    const uint64_t r = in[j] * scalar.operand - hi * q;
+    out[j] = r - (r >= q ? q : 0);
+  }
+}
+
+
+/**
+ * 128bitの累積値に対して，Barrett reductionなしに足し込める積の個数．
+ * 鍵交換の内積では一方の入力がlazyなNTTの出力（< 4q）であるため，積は2^(2 * 60 + 2)未満となる．
+ */
+constexpr size_t lazy_accumulation_bound = (size_t(1) << (128 - 2 * SEAL_USER_MOD_BIT_COUNT_MAX - 2)) - 1;
+
+/**
+ * acc[j] += in1[j] * in2[j]を128bitのまま計算する（reductionは行わない）．
+ * accの第j要素はacc[2j]（下位語）とacc[2j + 1]（上位語）に格納する．
+ */
+inline void multiply_accumulate_lazy(uint64_t* acc, const uint64_t* in1,
+                                     const uint64_t* in2, const size_t n){
+#pragma omp simd
+  for( size_t j = 0; j < n; ++j ){
+    unsigned long long p[2];
+    ::seal::util::multiply_uint64(in1[j], in2[j], p);
+    const uint64_t lo = acc[2*j] + p[0];
+    acc[2*j + 1] += p[1] + (lo < p[0]);
+    acc[2*j] = lo;
+  }
+}
+
+/// out[j] = acc[j] mod q（outがnullptrの場合はaccをその場でreductionする）
+inline void reduce_accumulator(uint64_t* out, uint64_t* acc, const size_t n,
+                               const ::seal::Modulus& modulus){
+  if( out != nullptr ){
+#pragma omp simd
+    for( size_t j = 0; j < n; ++j ){
+      out[j] = ::seal::util::barrett_reduce_128(acc + 2*j, modulus);
+    }
+  }else{
+#pragma omp simd
+    for( size_t j = 0; j < n; ++j ){
+      acc[2*j] = ::seal::util::barrett_reduce_128(acc + 2*j, modulus);
+      acc[2*j + 1] = 0;
+    }
+  }
+}
+
+
+namespace detail{
+/// z += a * b（128bit）
+inline void accumulate_product(unsigned long long* z, const uint64_t a, const uint64_t b){
+  unsigned long long p[2];
+  ::seal::util::multiply_uint64(a, b, p);
+  z[0] += p[0];
+  z[1] += p[1] + (z[0] < p[0]);
+}
+
+template<bool has_cur, bool has_prev, bool has_c>
+inline void multiply_accumulate_row(uint64_t* r, const uint64_t* cur, const uint64_t* prev,
+                                    const uint64_t* x0, const uint64_t* x1, const uint64_t* c,
+                                    const size_t n, const ::seal::Modulus& modulus){
+#pragma omp simd
+  for( size_t j = 0; j < n; ++j ){
+    unsigned long long z[2] = {0, 0};
+    if constexpr( has_cur ){ accumulate_product(z, cur[j], x0[j]); }
+    if constexpr( has_prev ){ accumulate_product(z, prev[j], x1[j]); }
+    if constexpr( has_c ){
+      z[0] += c[j];
+      z[1] += (z[0] < c[j]);
+    }
+    r[j] = ::seal::util::barrett_reduce_128(z, modulus);
+  }
+}
+}  // namespace detail
+
+/**
+ * 成分数kの暗号文oとサイズ2の暗号文xの積にcを加える．
+ * 第t成分（0 <= t <= k）をr_t = o_t x_0 + o_{t-1} x_1 + c_tとして，tの降順にその場で計算する
+ * （r_tはo_tとo_{t-1}のみに依存するため，上書き前の値を読み出せる）．
+ *
+ * o[t]は第t成分の該当limbの先頭（o[k]は新たな最上位成分の書き込み先），
+ * c[t]はcの第t成分の該当limbの先頭で，nullptrの場合は0とみなす．
+ * 積2つと和の128bitの累積（< 2^123）に対してBarrett reductionを1回だけ適用する．
+ */
+inline void multiply_accumulate_size2(uint64_t* const* o, const size_t k,
+                                      const uint64_t* x0, const uint64_t* x1,
+                                      const uint64_t* const* c, const size_t n,
+                                      const ::seal::Modulus& modulus){
+  using detail::multiply_accumulate_row;
+  for( size_t t = k + 1; t-- > 0; ){
+    uint64_t* r = o[t];
+    const uint64_t* cur = (t < k ? o[t] : nullptr);
+    const uint64_t* prev = (t > 0 ? o[t-1] : nullptr);
+    if( cur != nullptr && prev != nullptr ){
+      if( c[t] != nullptr ){
+        multiply_accumulate_row<true, true, true>(r, cur, prev, x0, x1, c[t], n, modulus);
+      }else{
+        multiply_accumulate_row<true, true, false>(r, cur, prev, x0, x1, c[t], n, modulus);
+      }
+    }else if( cur != nullptr ){
+      if( c[t] != nullptr ){
+        multiply_accumulate_row<true, false, true>(r, cur, prev, x0, x1, c[t], n, modulus);
+      }else{
+        multiply_accumulate_row<true, false, false>(r, cur, prev, x0, x1, c[t], n, modulus);
+      }
+    }else{
+      if( c[t] != nullptr ){
+        multiply_accumulate_row<false, true, true>(r, cur, prev, x0, x1, c[t], n, modulus);
+      }else{
+        multiply_accumulate_row<false, true, false>(r, cur, prev, x0, x1, c[t], n, modulus);
+      }
+    }
+  }
+}
+
+
+/**
+ * 各点jについて，num_coeffs個の係数coeffs[m*stride + j]を持つ多項式p_j(y)を
+ * p_j(y + shift[j])の係数に置き換える（Ruffini-Horner法によるTaylor shift）．
+ *
+ * 点ごとにO(num_coeffs^2)回の乗算を要するが，係数はstride個の点ごとにまとめて
+ * キャッシュ上で処理し，点方向にベクトル化する．shiftはShoupの前計算済みの値を与える．
+ */
+inline void taylor_shift(uint64_t* coeffs, const size_t num_coeffs, const size_t n,
+                         const size_t stride,
+                         const ::seal::util::MultiplyUIntModOperand* shift,
+                         const ::seal::Modulus& modulus){
+  for( size_t i = 0; i + 1 < num_coeffs; ++i ){
+    for( size_t m = num_coeffs - 1; m > i; --m ){
+      uint64_t* hi = coeffs + m * stride;
+      uint64_t* lo = coeffs + (m - 1) * stride;
+#pragma omp simd
+      for( size_t j = 0; j < n; ++j ){
+        lo[j] = ::seal::util::add_uint_mod(
+            lo[j], ::seal::util::multiply_uint_mod(hi[j], shift[j], modulus), modulus
+        );
+      }
+    }
+  }
+}
+
+
+}  // namespace he_wrapper_tmpl::kernel
@@ -0,0 +1,268 @@
+#pragma once
+
+#include<algorithm>
+#include<array>
+#include<cstdint>
+#include<cstring>
+#include<fstream>
+#include<stdexcept>
+#include<string>
+#include<type_traits>
+#include<vector>
+
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+#include"seal/valcheck.h"
+
+#include"util/for_loop.hpp"
+
+/**
+ * 公開鍵・鍵交換鍵の展開済みの形式での保存と，mmapによる読み込み
+ *
+ * ファイルは固定長のヘッダ，各分解の鍵の数の表，鍵の係数（成分，limb，係数の順）をそのまま並べたものからなる．
+ * ヘッダには鍵の種類と書き込んだ環境のバイト順を記録し，読み込み時に種類の異なる鍵や
+ * バイト順の異なる環境で保存したファイルを拒否する．
+ * 読み込み時はファイルをmmapし，ヘッダの検査の後に各鍵の係数を1回のコピーで鍵の領域に写す
+ * （SEALのシリアライズと異なり，解析，展開，一様乱数部分の再生成を行わない）．
+ * SEALの鍵は領域をメモリプールで管理するため，マップした領域をそのまま鍵として用いることはできない．
+ */
+namespace he_wrapper_tmpl::key_file{
+namespace detail{
+constexpr char magic[8] = {'H', 'E', 'C', 'R', 'K', 'E', 'Y', '2'};
+
+/// 書き込んだ環境のバイト順で保存する値（異なるバイト順で読むと0x04030201となる）
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+enum class KeyType : uint32_t {
+  public_key = 1,
+  relin_keys = 2,
+  galois_keys = 3,
+};
+
+template<class Key>
+constexpr KeyType key_type(){
+  using T = std::remove_const_t<Key>;
+  if constexpr( std::is_same_v<T, ::seal::PublicKey> ){
+    return KeyType::public_key;
+  }else if constexpr( std::is_same_v<T, ::seal::RelinKeys> ){
+    return KeyType::relin_keys;
+  }else{
+    static_assert(std::is_same_v<T, ::seal::GaloisKeys>, "unsupported key type");
+    return KeyType::galois_keys;
+  }
+}
+
+struct Header{
+  char magic[8];
+  uint32_t byte_order;
+  KeyType key_type;
+  std::array<uint64_t, 4> parms_id;
+  uint64_t poly_modulus_degree;
+  uint64_t coeff_modulus_size;
+  uint64_t num_decompositions;
+};
+
+/// 読み込み専用でmmapしたファイル
+class MappedFile{
+public:
+  explicit MappedFile(const std::string& path){
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if( fd_ < 0 ){
+      throw std::runtime_error("Failed to open " + path);
+    }
+    struct stat st;
+    if( ::fstat(fd_, &st) != 0 ){
+      ::close(fd_);
+      throw std::runtime_error("Failed to stat " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if( size_ > 0 ){
+      data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if( data_ == MAP_FAILED ){
+        ::close(fd_);
+        throw std::runtime_error("Failed to mmap " + path);
+      }
+      ::madvise(data_, size_, MADV_WILLNEED);
+    }
+  }
+  ~MappedFile(){
+    if( data_ != nullptr && data_ != MAP_FAILED ){ ::munmap(data_, size_); }
+    if( fd_ >= 0 ){ ::close(fd_); }
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const noexcept { return static_cast<const char*>(data_); }
+  size_t size() const noexcept { return size_; }
+
+private:
+  int fd_ = -1;
+
+  void* data_ = nullptr;
+
+  size_t size_ = 0;
+
+};
+
+/// 鍵を構成する暗号文（分解ごと）
+template<class Key>
+auto ciphertexts(Key& key){
+  using Ct = std::conditional_t<std::is_const_v<Key>, const ::seal::Ciphertext, ::seal::Ciphertext>;
+  std::vector<std::vector<Ct*>> out;
+  if constexpr( std::is_base_of_v<::seal::KSwitchKeys, std::remove_const_t<Key>> ){
+    for( auto& keys : key.data() ){
+      out.emplace_back();
+      for( auto& k : keys ){ out.back().push_back(&k.data()); }
+    }
+  }else{
+    out.push_back({&key.data()});
+  }
+  return out;
+}
+}  // namespace detail
+
+
+/// 公開鍵もしくは鍵交換鍵（RelinKeys, GaloisKeys）をpathに展開済みの形式で保存する
+template<class Key>
+void save_expanded(const Key& key, const ::seal::SEALContext& context, const std::string& path){
+  auto& context_data = *context.key_context_data();
+  const size_t coeff_count = context_data.parms().poly_modulus_degree();
+  const size_t coeff_modulus_size = context_data.parms().coeff_modulus().size();
+  const size_t poly_size = 2 * coeff_modulus_size * coeff_count;
+  const auto cts = detail::ciphertexts(key);
+
+  detail::Header header;
+  std::copy_n(detail::magic, sizeof(header.magic), header.magic);
+  header.byte_order = detail::byte_order_mark;
+  header.key_type = detail::key_type<Key>();
+  std::copy_n(key.parms_id().begin(), header.parms_id.size(), header.parms_id.begin());
+  header.poly_modulus_degree = coeff_count;
+  header.coeff_modulus_size = coeff_modulus_size;
+  header.num_decompositions = cts.size();
+
+  std::ofstream ofs(path, std::ios::binary);
+  if( !ofs ){
+    throw std::runtime_error("Failed to open " + path);
+  }
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for( const auto& row : cts ){
+    const uint64_t n = row.size();
+    ofs.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  }
+  for( const auto& row : cts ){
+    for( const auto* ct : row ){
+      if( ct->size() != 2 || ct->coeff_modulus_size() != coeff_modulus_size ){
+        throw std::invalid_argument("key is not valid for the key-level parameters");
+      }
+      ofs.write(reinterpret_cast<const char*>(ct->data()), poly_size * sizeof(uint64_t));
+    }
+  }
+  if( !ofs ){
+    throw std::runtime_error("Failed to write " + path);
+  }
+}
+
+/**
+ * save_expanded()で保存した鍵をmmapで読み込む．
+ * ヘッダと鍵の数の表からファイルサイズを検査した後に各鍵の領域をpoolから確保し，
+ * 鍵ごとのコピーはOpenMPで並列に行う．
+ */
+template<class Key>
+void load_expanded(Key& key, const ::seal::SEALContext& context, const std::string& path,
+                   const ::seal::MemoryPoolHandle& pool){
+  const detail::MappedFile file(path);
+  auto& context_data = *context.key_context_data();
+  const auto parms_id = context.key_parms_id();
+  const size_t coeff_count = context_data.parms().poly_modulus_degree();
+  const size_t coeff_modulus_size = context_data.parms().coeff_modulus().size();
+  const size_t poly_size = 2 * coeff_modulus_size * coeff_count;
+
+  detail::Header header;
+  if( file.size() < sizeof(header) ){
+    throw std::runtime_error(path + " is truncated");
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if( !std::equal(header.magic, header.magic + sizeof(header.magic), detail::magic) ){
+    throw std::invalid_argument(path + " is not a key file");
+  }
+  if( header.byte_order != detail::byte_order_mark ){
+    throw std::invalid_argument(path + " was saved with a different byte order");
+  }
+  if( header.key_type != detail::key_type<Key>() ){
+    throw std::invalid_argument(path + " does not contain this type of key");
+  }
+  if( !std::equal(header.parms_id.cbegin(), header.parms_id.cend(), parms_id.begin())
+      || header.poly_modulus_degree != coeff_count
+      || header.coeff_modulus_size != coeff_modulus_size ){
+    throw std::invalid_argument(path + " is not valid for encryption parameters");
+  }
+
+  // 領域を確保する前に，ファイルサイズがヘッダ + 表 + 鍵の数 * 鍵のサイズと一致することを確かめる
+  // （各値はファイルから読むため，桁あふれしないよう除算で比較する）
+  const size_t key_bytes = poly_size * sizeof(uint64_t);
+  const size_t body_size = file.size() - sizeof(header);
+  if( header.num_decompositions > body_size / sizeof(uint64_t) ){
+    throw std::runtime_error(path + " is truncated");
+  }
+  const size_t num_decompositions = header.num_decompositions;
+  const size_t table_size = num_decompositions * sizeof(uint64_t);
+  const size_t payload_size = body_size - table_size;
+  if( payload_size % key_bytes != 0 ){
+    throw std::runtime_error(path + " has an invalid size");
+  }
+  const size_t total_keys = payload_size / key_bytes;
+  auto num_keys = [&](const size_t i){
+    uint64_t v;
+    std::memcpy(&v, file.data() + sizeof(header) + i * sizeof(uint64_t), sizeof(v));
+    return v;
+  };
+  size_t counted_keys = 0;
+  for( size_t i = 0; i < num_decompositions; ++i ){
+    if( num_keys(i) > total_keys - counted_keys ){
+      throw std::runtime_error(path + " has an invalid size");
+    }
+    counted_keys += num_keys(i);
+  }
+  if( counted_keys != total_keys ){
+    throw std::runtime_error(path + " has an invalid size");
+  }
+  size_t offset = sizeof(header) + table_size;
+
+  if constexpr( std::is_base_of_v<::seal::KSwitchKeys, Key> ){
+    key.data().assign(num_decompositions, {});
+    for( size_t i = 0; i < num_decompositions; ++i ){
+      key.data()[i].resize(num_keys(i));
+    }
+  }else if( num_decompositions != 1 || num_keys(0) != 1 ){
+    throw std::invalid_argument(path + " does not contain a single key");
+  }
+  key.parms_id() = parms_id;
+
+  // 各鍵の係数のファイル上の位置
+  auto cts = detail::ciphertexts(key);
+  std::vector<std::pair<::seal::Ciphertext*, size_t>> targets;
+  for( const auto& row : cts ){
+    for( auto* ct : row ){
+      targets.emplace_back(ct, offset);
+      offset += key_bytes;
+    }
+  }
+
+  ::util::for_parallel([&](const size_t i){
+    auto& [ct, pos] = targets[i];
+    *ct = ::seal::Ciphertext(pool);
+    ct->resize(context, parms_id, 2);
+    ct->is_ntt_form() = true;
+    std::memcpy(ct->data(), file.data() + pos, key_bytes);
+  }, targets.size());
+
+  if( !::seal::is_metadata_valid_for(key, context) ){
+    throw std::invalid_argument(path + " is not valid for encryption parameters");
+  }
+}
+
+
+}  // namespace he_wrapper_tmpl::key_file
@@ -1,11 +1,81 @@
 #pragma once
 
+#include<algorithm>
+#include<filesystem>
+#include<fstream>
 #include<memory>
+#include<sstream>
+#include<string>
+#include<type_traits>
+
+#include<omp.h>
+
+#include"he_wrapper_tmpl/seal/key_file.hpp"
 
 namespace he_wrapper_tmpl{
 template<>
 class KeyManager<ImplSeal>{
 public:
+  /**
+   * SEALのメモリ確保の方針
+   *
+   * SEALの呼び出しは全て，以下のいずれかのメモリプールを経由する．
+   * - 作業領域（演算中の一時的な確保）：scratch_pool()
+   * - 暗号文・平文の本体：data_pool()
+   * 呼び出し側がプールを与えない場合，作業領域は並列領域内ではスレッドローカルなプール，
+   * それ以外ではグローバルなプールから確保し，本体はグローバルなプールから確保する．
+   * 呼び出し側が与えるプールは，並列に演算する場合はスレッドセーフでなければならない
+   * （::seal::MemoryPoolHandle::New()で生成したプール等）．
+   */
+  class AllocationPolicy{
+  public:
+    AllocationPolicy() = default;
+
+    /// 作業領域・本体ともにpoolから確保する
+    explicit AllocationPolicy(const ::seal::MemoryPoolHandle& pool)
+      : scratch_pool_(pool), data_pool_(pool){}
+
+    /// 作業領域をscratch_poolから，本体をdata_poolから確保する（未初期化のハンドルは既定の方針とする）
+    AllocationPolicy(const ::seal::MemoryPoolHandle& scratch_pool,
+                     const ::seal::MemoryPoolHandle& data_pool)
+      : scratch_pool_(scratch_pool), data_pool_(data_pool){}
+
+    /**
+     * 作業領域に用いるメモリプール．
+     * 既定では，OpenMPの並列領域内ではスレッドローカルなプールを返し，グローバルなプールのロック競合を避ける．
+     * （スレッドの終了とともに解放されるため，結果を保持する領域には用いないこと）
+     */
+    ::seal::MemoryPoolHandle scratch_pool() const {
+      if( scratch_pool_ ){ return scratch_pool_; }
+      if( omp_in_parallel() ){
+        return ::seal::MemoryManager::GetPool(::seal::mm_prof_opt::mm_force_thread_local);
+      }
+      return ::seal::MemoryManager::GetPool();
+    }
+
+    /// 暗号文・平文の本体に用いるメモリプール
+    ::seal::MemoryPoolHandle data_pool() const {
+      if( data_pool_ ){ return data_pool_; }
+      return ::seal::MemoryManager::GetPool();
+    }
+
+  private:
+    ::seal::MemoryPoolHandle scratch_pool_;
+
+    ::seal::MemoryPoolHandle data_pool_;
+
+  };
+
+  /**
+   * 鍵の保存形式（秘密鍵は常にSEALのシリアライズで保存する）
+   * - seeded: SEALのシリアライズ．生成した鍵は一様乱数部分をシードで置き換えた圧縮形式で保存する．
+   * - expanded: 展開済みの係数をそのまま並べた形式．読み込み時はmmapし，解析や展開を行わない．
+   */
+  enum class KeyFormat : int {
+    seeded,
+    expanded,
+  };
+
   KeyManager(){}
   virtual ~KeyManager() = default;
   KeyManager(const KeyManager&) = delete;
@@ -26,8 +96,24 @@ public:
   SETTER_AND_GETTER(default_scale, double)
   SETTER_AND_GETTER(logq0, int)
   SETTER_AND_GETTER(rotate_steps, std::vector<int>)
+  SETTER_AND_GETTER(rotation_plan, RotationPlan)
+  SETTER_AND_GETTER(parallel_grain, size_t)
+  SETTER_AND_GETTER(allocation_policy, AllocationPolicy)
+  SETTER_AND_GETTER(key_dir, std::string)
+  SETTER_AND_GETTER(key_format, KeyFormat)
   
   int num_slots() const { return encoder_->slot_count(); }
+
+  /**
+   * num_coeffs個の係数に対する要素ごとの演算（符号反転，スカラー倍等）に用いるスレッド数．
+   * 1スレッドあたりparallel_grain()個以上の係数を割り当てるため，小さな演算は逐次に実行する．
+   * 並列領域内（バッチ版の演算等）から呼ばれた場合も逐次に実行する．
+   */
+  int num_threads(const size_t num_coeffs) const {
+    if( omp_in_parallel() || parallel_grain_ == 0 ){ return 1; }
+    const size_t max_threads = omp_get_max_threads();
+    return std::clamp<size_t>(num_coeffs / parallel_grain_, 1, max_threads);
+  }
   
   [[deprecated]]
   auto& modulus_bits_list() noexcept { return modulus_bits_list_; }
@@ -53,37 +139,91 @@ public:
   }
   void gen_pk(){
     pk_ = std::make_unique<::seal::PublicKey>();
-    key_gen_->create_public_key(*pk_);
+    if( !keeps_seeded_keys() ){
+      key_gen_->create_public_key(*pk_);
+      std::string().swap(seeded_pk_);
+    }else{
+      seeded_pk_ = expand(*pk_, key_gen_->create_public_key());
+    }
     gen_encryptor();
     gen_evaluator();
   }
   void gen_rlk(){
     rlk_ = std::make_unique<::seal::RelinKeys>();
-    key_gen_->create_relin_keys(*rlk_);
+    if( !keeps_seeded_keys() ){
+      key_gen_->create_relin_keys(*rlk_);
+      std::string().swap(seeded_rlk_);
+    }else{
+      seeded_rlk_ = expand(*rlk_, key_gen_->create_relin_keys());
+    }
   }
   void gen_glk(){
     glk_ = std::make_unique<::seal::GaloisKeys>();
-    if( rotate_steps_.empty() ){
-      key_gen_->create_galois_keys(*glk_);
+    const auto& steps = (!rotate_steps_.empty() ? rotate_steps_ : rotation_plan_.keys());
+    if( !keeps_seeded_keys() ){
+      if( steps.empty() ){
+        key_gen_->create_galois_keys(*glk_);
+      }else{
+        key_gen_->create_galois_keys(steps, *glk_);
+      }
+      std::string().swap(seeded_glk_);
     }else{
-      key_gen_->create_galois_keys(rotate_steps_, *glk_);
+      seeded_glk_ = (steps.empty() ? expand(*glk_, key_gen_->create_galois_keys())
+                                   : expand(*glk_, key_gen_->create_galois_keys(steps)));
     }
   }
   void gen_bsk(){
     throw std::logic_error("Bootstrapping is not supported.");
   }
 
-  void load_sk(){ return; }
-  void load_pk(){ return; }
-  void load_rlk(){ return; }
-  void load_glk(){ return; }
-  void load_bsk(){ return; }
+  /*
+   * 鍵の読み込みと保存（gen_params()の後に呼ぶ）．
+   * 鍵はkey_dir()の下に，名前ごとに<name>.seal（SEALのシリアライズ）もしくは<name>.bin（展開済みの形式）として置く．
+   * 読み込み時は<name>.binがあればmmapで読み込み，なければ<name>.sealを読み込む．
+   */
+  void load_sk(){
+    sk_ = std::make_unique<::seal::SecretKey>();
+    load_key(*sk_, "sk");
+    // 以降に生成する鍵が読み込んだ秘密鍵に対応するようにする
+    key_gen_ = std::make_unique<::seal::KeyGenerator>(*context_, *sk_);
+    gen_decryptor();
+  }
+  void load_pk(){
+    pk_ = std::make_unique<::seal::PublicKey>();
+    load_key(*pk_, "pk");
+    gen_encryptor();
+    gen_evaluator();
+  }
+  void load_rlk(){
+    rlk_ = std::make_unique<::seal::RelinKeys>();
+    load_key(*rlk_, "rlk");
+  }
+  void load_glk(){
+    glk_ = std::make_unique<::seal::GaloisKeys>();
+    load_key(*glk_, "glk");
+  }
+  void load_bsk(){
+    throw std::logic_error("Bootstrapping is not supported.");
+  }
+
+  void save_sk(){ save_key(*sk_, "sk"); }
+  void save_pk(){ save_key(*pk_, "pk", &seeded_pk_); }
+  void save_rlk(){ save_key(*rlk_, "rlk", &seeded_rlk_); }
+  void save_glk(){ save_key(*glk_, "glk", &seeded_glk_); }
+  void save_bsk(){
+    throw std::logic_error("Bootstrapping is not supported.");
+  }
 
-  void save_sk(){ return; }
-  void save_pk(){ return; }
-  void save_rlk(){ return; }
-  void save_glk(){ return; }
-  void save_bsk(){ return; }
+  /// 有効にした鍵が全てkey_dir()に保存されているか
+  bool has_saved_keys() const {
+    auto exists = [&](const std::string& name){
+      return std::filesystem::exists(key_path(name + ".seal"))
+          || std::filesystem::exists(key_path(name + ".bin"));
+    };
+    return !key_dir_.empty()
+        && (!status_sk_ || exists("sk")) && (!status_pk_ || exists("pk"))
+        && (!status_rlk_ || exists("rlk")) && (!status_glk_ || exists("glk"));
+  }
   
   void set_sk_to_encryptor(){
     encryptor_->set_secret_key(*sk_);
@@ -108,6 +248,12 @@ public:
     return enable_glk();
   }
 
+  /// planの鍵のみを生成する（鍵が直接存在しない回転はOperator::rotate()がplanに従って分解する）
+  auto& enable_glk(const RotationPlan& plan){
+    rotation_plan_ = plan;
+    return enable_glk();
+  }
+
 #define DISABLE(name)          \
   auto& disable_##name(){      \
     status_##name##_ = false;  \
@@ -147,6 +293,37 @@ public:
     if( status_bsk_ ){ save_bsk(); }
   }
 
+  /**
+   * Galois鍵1つあたりのバイト数．
+   * 鍵のmodulus数をKとして，K - 1個の分解それぞれについてK個のlimbからなる2成分の多項式を持つ．
+   */
+  size_t galois_key_bytes() const {
+    const size_t key_modulus_size = params_->coeff_modulus().size();
+    return (key_modulus_size - 1) * 2 * key_modulus_size * poly_degree_ * sizeof(uint64_t);
+  }
+
+  /// 演算の作業領域に用いるメモリプール（allocation_policy()に従う）
+  ::seal::MemoryPoolHandle pool() const { return allocation_policy_.scratch_pool(); }
+
+  /// 暗号文・平文の本体に用いるメモリプール（allocation_policy()に従う）
+  ::seal::MemoryPoolHandle data_pool() const { return allocation_policy_.data_pool(); }
+
+  /// レベルlevelのパラメータ（levelが範囲外の場合はnullptr）
+  std::shared_ptr<const ::seal::SEALContext::ContextData> context_data(const int level) const {
+    if( context_ == nullptr || level < 0 ){ return nullptr; }
+    auto context_data = context_->first_context_data();
+    if( level > static_cast<int>(context_data->chain_index()) ){ return nullptr; }
+    while( static_cast<int>(context_data->chain_index()) > level ){
+      context_data = context_data->next_context_data();
+    }
+    return context_data;
+  }
+
+  /// decryptor()と同じ秘密鍵をもつ，独立した復号器（スレッドごとに用いる）
+  std::unique_ptr<::seal::Decryptor> create_decryptor() const {
+    return std::make_unique<::seal::Decryptor>(*context_, *sk_);
+  }
+
   const auto& rlk() const { return *rlk_; }
   const auto& glk() const { return *glk_; }
   
@@ -159,6 +336,82 @@ public:
   
  
 private:
+  /**
+   * シード圧縮形式の鍵inをシリアライズして返し，展開した鍵をoutに読み込む．
+   * （シリアライズした鍵はsave_*()で保存するまで保持する）
+   */
+  /// gen_pk(), gen_rlk(), gen_glk()がシード圧縮形式を保存用に保持するか（seeded形式で保存する場合のみ）
+  bool keeps_seeded_keys() const noexcept {
+    return !key_dir_.empty() && key_format_ == KeyFormat::seeded;
+  }
+
+  template<class T, class Seeded>
+  std::string expand(T& out, const Seeded& in) const {
+    std::stringstream ss;
+    in.save(ss);
+    out.load(*context_, ss);
+    return ss.str();
+  }
+
+  std::string key_path(const std::string& file_name) const {
+    return (std::filesystem::path(key_dir_) / file_name).string();
+  }
+
+  template<class T>
+  void load_key(T& out, const std::string& name){
+    if( key_dir_.empty() ){
+      throw std::invalid_argument("key_dir is not set");
+    }
+    if constexpr( !std::is_same_v<T, ::seal::SecretKey> ){
+      const auto expanded = key_path(name + ".bin");
+      if( std::filesystem::exists(expanded) ){
+        key_file::load_expanded(out, *context_, expanded, data_pool());
+        return;
+      }
+    }
+    const auto path = key_path(name + ".seal");
+    std::ifstream ifs(path, std::ios::binary);
+    if( !ifs ){
+      throw std::runtime_error("Failed to open " + path);
+    }
+    out.load(*context_, ifs);
+  }
+
+  /// seededが空でない場合，seeded形式では*seededをそのまま保存する（いずれの形式でも保存後は破棄する）
+  template<class T>
+  void save_key(const T& in, const std::string& name, std::string* seeded = nullptr){
+    if( key_dir_.empty() ){
+      throw std::invalid_argument("key_dir is not set");
+    }
+    std::filesystem::create_directories(key_dir_);
+    const auto path = key_path(name + ".seal");
+    const auto expanded = key_path(name + ".bin");
+
+    if constexpr( !std::is_same_v<T, ::seal::SecretKey> ){
+      if( key_format_ == KeyFormat::expanded ){
+        key_file::save_expanded(in, *context_, expanded);
+        std::filesystem::remove(path);
+        if( seeded != nullptr ){ std::string().swap(*seeded); }
+        return;
+      }
+    }
+
+    std::ofstream ofs(path, std::ios::binary);
+    if( !ofs ){
+      throw std::runtime_error("Failed to open " + path);
+    }
+    if( seeded != nullptr && !seeded->empty() ){
+      ofs.write(seeded->data(), seeded->size());
+      std::string().swap(*seeded);
+    }else{
+      in.save(ofs);
+    }
+    if( !ofs ){
+      throw std::runtime_error("Failed to write " + path);
+    }
+    std::filesystem::remove(expanded);
+  }
+
   void gen_encryptor(){
     encryptor_ = std::make_unique<::seal::Encryptor>(*context_, *pk_);
   }
@@ -182,6 +435,11 @@ private:
   double default_scale_ = 0.0;
 
   int logq0_ = 0;
+
+  /// 演算内の並列化で1スレッドに割り当てる係数の最小数（0の場合は並列化しない）
+  size_t parallel_grain_ = 1 << 16;
+
+  AllocationPolicy allocation_policy_;
   
   bool status_sk_ = false;
   bool status_pk_ = false;
@@ -191,7 +449,20 @@ private:
   bool status_bsk_ = false;
 
   std::vector<int> rotate_steps_;
+
+  /// rotate_steps_が空の場合に用いる，生成するGalois鍵の計画
+  RotationPlan rotation_plan_;
   
+  /// 鍵の保存先のディレクトリ（空でなくseeded形式の場合，gen_pk(), gen_rlk(), gen_glk()はシード圧縮形式を保持する）
+  std::string key_dir_;
+
+  KeyFormat key_format_ = KeyFormat::seeded;
+
+  /// save_*()で保存するまで保持する，シード圧縮形式でシリアライズした鍵
+  std::string seeded_pk_;
+  std::string seeded_rlk_;
+  std::string seeded_glk_;
+
   std::unique_ptr<::seal::EncryptionParameters> params_;
 
   std::unique_ptr<::seal::SEALContext> context_;
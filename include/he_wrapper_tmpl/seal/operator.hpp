@@ -2,6 +2,7 @@
 
 #include"util/error.hpp"
 
+#include"kernel.hpp"
 #include"operator_modified_seal.hpp"
 
 namespace he_wrapper_tmpl{
@@ -19,13 +20,81 @@ inline EncodingParams<ImplSeal> Operator<ImplSeal>::get_initial_encoding_params(
   return ep;
 }
 
+
+template<>
+inline int Operator<ImplSeal>::level(const EncodingParams<ImplSeal>& in) const {
+  const auto context_data = key_manager().context().get_context_data(in.parms_id);
+  if( !context_data ){
+    throw std::invalid_argument("parms_id is not valid for the encryption parameters.");
+  }
+  return context_data->chain_index();
+}
+
+template<>
+inline void Operator<ImplSeal>::add(EncodingParams<ImplSeal>& out,
+                                    const EncodingParams<ImplSeal>& in) const {
+  if( out.parms_id != in.parms_id ){
+    throw std::invalid_argument("parms_id mismatch.");
+  }
+  if( !::seal::util::are_close<double>(out.scale, in.scale) ){
+    throw std::invalid_argument("scale mismatch.");
+  }
+}
+
+template<>
+inline void Operator<ImplSeal>::mul(EncodingParams<ImplSeal>& out,
+                                    const EncodingParams<ImplSeal>& in) const {
+  if( out.parms_id != in.parms_id ){
+    throw std::invalid_argument("parms_id mismatch.");
+  }
+  const auto context_data = key_manager().context().get_context_data(out.parms_id);
+  if( !context_data ){
+    throw std::invalid_argument("parms_id is not valid for the encryption parameters.");
+  }
+  // SEALと同じ順序で計算し，暗号文のscaleと一致させる
+  const double scale = out.scale * in.scale;
+  if( !::seal::is_scale_within_bounds(scale, *context_data) ){
+    throw std::invalid_argument("scale out of bounds.");
+  }
+  out.scale = scale;
+}
+
+template<>
+inline void Operator<ImplSeal>::rescale(EncodingParams<ImplSeal>& out) const {
+  const auto context_data = key_manager().context().get_context_data(out.parms_id);
+  if( !context_data ){
+    throw std::invalid_argument("parms_id is not valid for the encryption parameters.");
+  }
+  const auto next_context_data = context_data->next_context_data();
+  if( !next_context_data ){
+    throw std::invalid_argument("End of modulus switching chain reached.");
+  }
+  out.scale /= static_cast<double>(context_data->parms().coeff_modulus().back().value());
+  out.parms_id = next_context_data->parms_id();
+}
+
+template<>
+inline void Operator<ImplSeal>::mod_down(EncodingParams<ImplSeal>& out, const int n) const {
+  auto context_data = key_manager().context().get_context_data(out.parms_id);
+  if( !context_data ){
+    throw std::invalid_argument("parms_id is not valid for the encryption parameters.");
+  }
+  for( int i = 0; i < n; ++i ){
+    if( !context_data->next_context_data() ){
+      throw std::invalid_argument("End of modulus switching chain reached.");
+    }
+    context_data = context_data->next_context_data();
+  }
+  out.parms_id = context_data->parms_id();
+}
+
 template<>
 template<class MsgType>
 void Operator<ImplSeal>::encode(Plaintext<ImplSeal>& out,
                                 const RawVec<MsgType>& in,
                                 const double scale) const {
   allocate(out, -1, 0.0);
-  key_manager().encoder().encode(in.cref(), scale, out.ref());
+  key_manager().encoder().encode(in.cref(), scale, out.ref(), key_manager().pool());
 }
 
 template<>
@@ -33,31 +102,87 @@ template<class MsgType>
 void Operator<ImplSeal>::encode(Plaintext<ImplSeal>& out,
                                 const RawVec<MsgType>& in,
                                 const EncodingParams<ImplSeal>& params) const {
-  allocate(out, -1, 0.0);
-  key_manager().encoder().encode(in.cref(), params.parms_id, params.scale, out.ref());
+  allocate(out, level(params), 0.0);
+  key_manager().encoder().encode(in.cref(), params.parms_id, params.scale, out.ref(),
+                                 key_manager().pool());
 }
 
 template<>
 template<class MsgType>
 void Operator<ImplSeal>::decode(RawVec<MsgType>& out,
                                 const Plaintext<ImplSeal>& in) const {
-  key_manager().encoder().decode(in.cref(), out.ref());
+  key_manager().encoder().decode(in.cref(), out.ref(), key_manager().pool());
 }
 
 template<>
 inline void Operator<ImplSeal>::encrypt(Ciphertext<ImplSeal>& out,
                                         const Plaintext<ImplSeal>& in) const {
-  allocate(out, -1, 0.0);
-  key_manager().encryptor().encrypt(in.cref(), out.ref());
+  allocate(out, level(EncodingParams<ImplSeal>(in)), 0.0);
+  key_manager().encryptor().encrypt(in.cref(), out.ref(), key_manager().pool());
+}
+
+template<>
+inline void Operator<ImplSeal>::encrypt(Ciphertext<ImplSeal>& out,
+                                        const Plaintext<ImplSeal>& in,
+                                        const size_t size) const {
+  if( size < 2 ){
+    throw std::invalid_argument("Invalid target ciphertext size.");
+  }
+  encrypt(out, in);
+  if( size == out.size() ){
+    return;
+  }
+
+  // 第j成分（j >= 2）ごとに0の暗号文(z0, z1)を生成し，z0を第j-1成分に，z1を第j成分に加える．
+  // 復号時にはs^{j-1}(z0 + z1 s) = s^{j-1} eが加わるのみであり，拡張した成分も一様に見える．
+  const auto parms_id = out.cref().parms_id();
+  std::vector<::seal::Ciphertext> zeros(size - out.size());
+#pragma omp parallel for
+  for( size_t j = 0; j < zeros.size(); ++j ){
+    key_manager().encryptor().encrypt_zero(parms_id, zeros[j], key_manager().pool());
+  }
+
+  const size_t old_size = out.size();
+  out.ref().resize(size);
+
+  auto &context_data = *key_manager().context().get_context_data(parms_id);
+  auto &coeff_modulus = context_data.parms().coeff_modulus();
+  const size_t coeff_count = context_data.parms().poly_modulus_degree();
+  const size_t coeff_modulus_size = coeff_modulus.size();
+  for( size_t j = old_size; j < size; ++j ){
+    const auto& z = zeros[j - old_size];
+    for( size_t k = 0; k < 2; ++k ){
+      ::seal::util::RNSIter out_iter(out.ref().data(j - 1 + k), coeff_count);
+      ::seal::util::ConstRNSIter z_iter(z.data(k), coeff_count);
+      ::seal::util::add_poly_coeffmod(out_iter, z_iter, coeff_modulus_size, coeff_modulus, out_iter);
+    }
+  }
 }
 
 template<>
 inline void Operator<ImplSeal>::decrypt(Plaintext<ImplSeal>& out,
                                         const Ciphertext<ImplSeal>& in){
-  allocate(out, -1, 0.0);
+  allocate_like(out, in);
   key_manager().decryptor().decrypt(in.cref(), out.ref());
 }
 
+template<>
+inline void Operator<ImplSeal>::decrypt(std::span<Plaintext<ImplSeal>> out,
+                                        std::span<const Ciphertext<ImplSeal>> in){
+  batch(out.size(), in.size());
+  // ::seal::Decryptor::decryptは非constのため，スレッドごとに復号器を生成する
+  std::vector<std::unique_ptr<::seal::Decryptor>> decryptors(omp_get_max_threads());
+  util::for_parallel([&](const size_t i){
+    auto& decryptor = decryptors.at(omp_get_thread_num());
+    if( !decryptor ){
+      decryptor = key_manager().create_decryptor();
+    }
+    check_ptr(in[i], "in");
+    allocate_like(out[i], in[i]);
+    decryptor->decrypt(in[i].cref(), out[i].ref());
+  }, out.size());
+}
+
 template<>
 inline void Operator<ImplSeal>::load(Plaintext<ImplSeal>& out,
                                      const std::filesystem::path& path) const {
@@ -92,46 +217,141 @@ template<>
 inline void Operator<ImplSeal>::save_with_sym_encryption(const Plaintext<ImplSeal>& in,
                                                          const std::filesystem::path& path) const {
   std::ofstream ofs(path, std::ios::binary);
-  key_manager().encryptor().encrypt_symmetric(in.cref()).save(ofs);
+  key_manager().encryptor().encrypt_symmetric(in.cref(), key_manager().pool()).save(ofs);
 }
 
 
 template<>
 inline void Operator<ImplSeal>::negate(Ciphertext<ImplSeal>& out,
                                        const Ciphertext<ImplSeal>& in) const {
-  copy(out, in);
-  const int size = out.size();
-  const int n = key_manager().poly_degree();
-  const int moduli_count = out.cref().coeff_modulus_size();
-  const auto& moduli = key_manager().context().get_context_data(out.cref().parms_id())->parms().coeff_modulus();
-  auto itr = out.ref().data();
-  for( int k = 0; k < size; ++k ){
-    for( int i = 0; i < moduli_count; ++i ){
-      const auto q = moduli.at(i).value();
-      std::transform(itr, itr + n, itr,
-                     [&](uint64_t v){ return (v == 0 ? 0 : q - v); });
-      itr += n;
-    }
+  check_ptr(in, "in");
+  if( out.ptr() != in.ptr() ){
+    // inを複製せず，符号反転した値を直接outへ書き込む
+    allocate_like(out, in);
+    out.resize(key_manager(), EncodingParams<ImplSeal>(in), in.size());
   }
+  const size_t size = in.size();
+  const size_t n = key_manager().poly_degree();
+  const size_t moduli_count = in.cref().coeff_modulus_size();
+  const auto& moduli = key_manager().context().get_context_data(in.cref().parms_id())->parms().coeff_modulus();
+  const uint64_t* in_itr = in.cref().data();
+  uint64_t* out_itr = out.ref().data();
+  // (成分, limb)ごとに独立に計算する
+  util::multi_for_parallel([&](const size_t k, const size_t i){
+    const auto q = moduli.at(i).value();
+    const size_t offset = (k * moduli_count + i) * n;
+    std::transform(in_itr + offset, in_itr + offset + n, out_itr + offset,
+                   [q](uint64_t v){ return (v == 0 ? 0 : q - v); });
+  }, key_manager().num_threads(size * moduli_count * n), size, moduli_count);
 
 }
 
 template<>
 inline void Operator<ImplSeal>::invert(Plaintext<ImplSeal>& out,
                                        const Plaintext<ImplSeal>& in) const {
-  copy(out, in);
+  check_ptr(in, "in");
+  if( out.ptr() != in.ptr() ){
+    // inを複製せず，逆元を直接outへ書き込む
+    allocate(out, -1, 0.0);
+    out.resize(key_manager(), EncodingParams<ImplSeal>(in));
+  }
   const int n = key_manager().poly_degree();
-  const int moduli_count = out.cref().coeff_count() / n;
-  const auto& moduli = key_manager().context().get_context_data(out.cref().parms_id())->parms().coeff_modulus();
-  auto itr = out.ref().data();
-  for( int i = 0; i < moduli_count; ++i ){
-    const auto q = moduli.at(i).value();
-    std::transform(itr, itr + n, itr, [&](uint64_t v){
-      uint64_t inv_v;
-      seal::util::try_invert_uint_mod(v, q, inv_v);
-      return inv_v;
-    });
-    itr += n;
+  const int moduli_count = in.cref().coeff_count() / n;
+  const auto& moduli = key_manager().context().get_context_data(in.cref().parms_id())->parms().coeff_modulus();
+  const uint64_t* in_itr = in.cref().data();
+  uint64_t* out_itr = out.ref().data();
+  util::multi_for_parallel([&](const int i){
+    kernel::batch_invert(out_itr + i * n, in_itr + i * n, n, moduli.at(i));
+  }, key_manager().num_threads(moduli_count * n), moduli_count);
+}
+
+template<>
+inline void Operator<ImplSeal>::invert(Plaintext<ImplSeal>& out) const {
+  invert(out, out);
+}
+
+
+template<>
+inline void Operator<ImplSeal>::taylor_shift(const std::vector<Ciphertext<ImplSeal>*>& inout,
+                                             const Ciphertext<ImplSeal>& shift) const {
+  check_ptr(shift, "shift");
+  const size_t num_coeffs = inout.size();
+  if( num_coeffs == 0 ){ return; }
+  for( const auto* ct : inout ){
+    check_ptr(*ct, "inout");
+    if( ct->cref().parms_id() != shift.cref().parms_id() ){
+      throw std::invalid_argument("inout and shift parameter mismatch");
+    }
+    if( !ct->cref().is_ntt_form() ){
+      throw std::invalid_argument("inout must be in NTT form");
+    }
+  }
+
+  const auto &context_data = *key_manager().context().get_context_data(shift.cref().parms_id());
+  const auto &coeff_modulus = context_data.parms().coeff_modulus();
+  const size_t n = context_data.parms().poly_modulus_degree();
+  const size_t coeff_modulus_size = coeff_modulus.size();
+  const size_t poly_size = n * coeff_modulus_size;
+
+  // shiftが自明な暗号文(rho, 0, ..., 0)であれば，各成分にrhoをかけるだけでよいため，
+  // 成分ごと・点ごとに独立なスカラーのTaylor shiftに帰着する
+  if( !std::all_of(shift.cref().data() + poly_size, shift.cref().data() + shift.size() * poly_size,
+                   [](const uint64_t v){ return v == 0; }) ){
+    throw std::invalid_argument("shift must be a trivial ciphertext");
+  }
+  for( size_t m = 1; m < num_coeffs; ++m ){
+    if( !::seal::util::are_close<double>(inout[m]->scale() * shift.scale(), inout[m-1]->scale()) ){
+      throw std::invalid_argument("scale mismatch");
+    }
+  }
+
+  // 結果のサイズに拡張する（既存の成分は保持され，拡張した成分は0となる）
+  std::vector<size_t> sizes(num_coeffs);
+  size_t max_size = 0;
+  for( size_t i = num_coeffs; i-- > 0; ){
+    sizes[i] = std::max(inout[i]->size(), (i + 1 < num_coeffs ? sizes[i+1] + 1 : 0));
+    max_size = std::max(max_size, inout[i]->size());
+  }
+  std::vector<uint64_t*> data(num_coeffs);
+  for( size_t i = 0; i < num_coeffs; ++i ){
+    inout[i]->ref().resize(sizes[i]);
+    data[i] = inout[i]->ref().data();
+  }
+
+  constexpr size_t block_size = 64;
+  const size_t num_blocks = (n + block_size - 1) / block_size;
+  const uint64_t* rho = shift.cref().data();
+  const int num_threads = key_manager().num_threads(max_size * num_coeffs * poly_size);
+#pragma omp parallel num_threads(num_threads) if(num_threads > 1)
+  {
+    std::vector<uint64_t> buf(num_coeffs * block_size);
+    std::vector<::seal::util::MultiplyUIntModOperand> rho_shoup(block_size);
+#pragma omp for collapse(3) schedule(static)
+    for( size_t t = 0; t < max_size; ++t ){
+      for( size_t l = 0; l < coeff_modulus_size; ++l ){
+        for( size_t b = 0; b < num_blocks; ++b ){
+          const size_t offset = l * n + b * block_size;
+          const size_t len = std::min(block_size, n - b * block_size);
+          for( size_t j = 0; j < len; ++j ){
+            rho_shoup[j].set(rho[offset + j], coeff_modulus[l]);
+          }
+          for( size_t m = 0; m < num_coeffs; ++m ){
+            if( t < sizes[m] ){
+              std::copy_n(data[m] + t * poly_size + offset, len, buf.data() + m * block_size);
+            }else{
+              std::fill_n(buf.data() + m * block_size, len, 0);
+            }
+          }
+          kernel::taylor_shift(buf.data(), num_coeffs, len, block_size, rho_shoup.data(),
+                               coeff_modulus[l]);
+          for( size_t i = 0; i < num_coeffs; ++i ){
+            if( t < sizes[i] ){
+              std::copy_n(buf.data() + i * block_size, len, data[i] + t * poly_size + offset);
+            }
+          }
+        }
+      }
+    }
   }
 }
 
@@ -150,7 +370,7 @@ inline void Operator<ImplSeal>::add(Ciphertext<ImplSeal>& out,
   if( out.ptr() == in1.ptr() ){
     add(out, in2);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in1);
     check_ptr(out, "out", in1, "in1", in2, "in2");
     key_manager().evaluator().add_plain(in1.cref(), in2.cref(), out.ref());
   }
@@ -172,7 +392,7 @@ inline void Operator<ImplSeal>::add(Ciphertext<ImplSeal>& out,
   }else if( out.ptr() == in2.ptr() ){
     add(out, in1);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in1);
     check_ptr(out, "out", in1, "in1", in2, "in2");
     key_manager().evaluator().add(in1.cref(), in2.cref(), out.ref());
   }
@@ -194,7 +414,7 @@ inline void Operator<ImplSeal>::sub(Ciphertext<ImplSeal>& out,
   if( out.ptr() == in1.ptr() ){
     sub(out, in2);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in1);
     check_ptr(out, "out", in1, "in1", in2, "in2");
     key_manager().evaluator().sub_plain(in1.cref(), in2.cref(), out.ref());
   }
@@ -214,9 +434,11 @@ inline void Operator<ImplSeal>::sub(Ciphertext<ImplSeal>& out,
   if( out.ptr() == in1.ptr() ){
     sub(out, in2);
   }else if( out.ptr() == in2.ptr() ){
-    sub(out, in1);
+    // out = in1 - out
+    negate(out, out);
+    add(out, in1);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in1);
     check_ptr(out, "out", in1, "in1", in2, "in2");
     key_manager().evaluator().sub(in1.cref(), in2.cref(), out.ref());
   }
@@ -226,7 +448,7 @@ template<>
 inline void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
                                     const Plaintext<ImplSeal>& in) const {
   check_ptr(out, "out", in, "in");
-  key_manager().evaluator().multiply_plain_inplace(out.ref(), in.cref());
+  key_manager().evaluator().multiply_plain_inplace(out.ref(), in.cref(), key_manager().pool());
 }
   
 template<>
@@ -236,9 +458,10 @@ inline void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
   if( out.ptr() == in1.ptr() ){
     mul(out, in2);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in1);
     check_ptr(out, "out", in1, "in1", in2, "in2");
-    key_manager().evaluator().multiply_plain(in1.cref(), in2.cref(), out.ref());
+    key_manager().evaluator().multiply_plain(in1.cref(), in2.cref(), out.ref(),
+                                             key_manager().pool());
   }
 }
 
@@ -246,7 +469,7 @@ template<>
 inline void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
                                     const Ciphertext<ImplSeal>& in) const {
   check_ptr(out, "out", in, "in");
-  key_manager().evaluator().multiply_inplace(out.ref(), in.cref());
+  key_manager().evaluator().multiply_inplace(out.ref(), in.cref(), key_manager().pool());
 }
 
 template<>
@@ -258,9 +481,9 @@ inline void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
   }else if( out.ptr() == in2.ptr() ){
     mul(out, in1);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in1);
     check_ptr(out, "out", in1, "in1", in2, "in2");
-    key_manager().evaluator().multiply(in1.cref(), in2.cref(), out.ref());
+    key_manager().evaluator().multiply(in1.cref(), in2.cref(), out.ref(), key_manager().pool());
   }
 }
 
@@ -269,7 +492,7 @@ inline void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
 template<>
 inline void Operator<ImplSeal>::square(Ciphertext<ImplSeal>& out) const {
   check_ptr(out, "out");
-  key_manager().evaluator().square_inplace(out.ref());
+  key_manager().evaluator().square_inplace(out.ref(), key_manager().pool());
 }
 
 template<>
@@ -278,9 +501,9 @@ inline void Operator<ImplSeal>::square(Ciphertext<ImplSeal>& out,
   if( out.ptr() == in.ptr() ){
     square(out);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in);
     check_ptr(out, "out", in, "in");
-    key_manager().evaluator().square(in.cref(), out.ref());
+    key_manager().evaluator().square(in.cref(), out.ref(), key_manager().pool());
   }
 }
 
@@ -288,7 +511,8 @@ inline void Operator<ImplSeal>::square(Ciphertext<ImplSeal>& out,
 template<>
 inline void Operator<ImplSeal>::relinearize(Ciphertext<ImplSeal>& out) const {
   check_ptr(out, "out");
-  key_manager().evaluator().relinearize_inplace(out.ref(), key_manager().rlk());
+  key_manager().evaluator().relinearize_inplace(out.ref(), key_manager().rlk(),
+                                                  key_manager().pool());
 }
 
 template<>
@@ -297,9 +521,10 @@ inline void Operator<ImplSeal>::relinearize(Ciphertext<ImplSeal>& out,
   if( out.ptr() == in.ptr() ){
     relinearize(out);
   }else{
-    allocate(out, -1, 0.0);
+    allocate_like(out, in);
     check_ptr(out, "out", in, "in");
-    key_manager().evaluator().relinearize(in.cref(), key_manager().rlk(), out.ref());
+    key_manager().evaluator().relinearize(in.cref(), key_manager().rlk(), out.ref(),
+                                          key_manager().pool());
   }
 }
 
@@ -313,15 +538,15 @@ inline void Operator<ImplSeal>::rescale(Plaintext<ImplSeal>& out) const {
 template<>
 inline void Operator<ImplSeal>::rescale(Ciphertext<ImplSeal>& out) const {
   check_ptr(out, "out");
-  key_manager().evaluator().rescale_to_next_inplace(out.ref());
+  key_manager().evaluator().rescale_to_next_inplace(out.ref(), key_manager().pool());
 }
 
 template<>
 inline void Operator<ImplSeal>::rescale(Ciphertext<ImplSeal>& out,
                                         const Ciphertext<ImplSeal>& in) const {
-  allocate(out, -1, 0.0);
+  allocate_like(out, in, 1);
   check_ptr(out, "out", in, "in");
-  key_manager().evaluator().rescale_to_next(in.cref(), out.ref());
+  key_manager().evaluator().rescale_to_next(in.cref(), out.ref(), key_manager().pool());
 }
 
 
@@ -346,7 +571,7 @@ template<>
 inline void Operator<ImplSeal>::mod_down(Ciphertext<ImplSeal>& out, const int n) const {
   check_ptr(out, "out");
   for( int i = 0; i < n; ++i ){
-    key_manager().evaluator().mod_switch_to_next_inplace(out.ref());
+    key_manager().evaluator().mod_switch_to_next_inplace(out.ref(), key_manager().pool());
   }
 }
 
@@ -364,9 +589,20 @@ inline void Operator<ImplSeal>::rotate(Ciphertext<ImplSeal>& out,
                                        const int shift_count) const {
   check_ptr(out, "out");
   if( shift_count == 0 ){ return; }
-  key_manager().evaluator().rotate_vector_inplace(
-      out.ref(), shift_count, key_manager().glk()
-  );
+  // 鍵が直接存在しない回転は，鍵の計画に従って分解する
+  const auto steps = (has_rotation_key(shift_count)
+                      ? std::vector<int>{} : key_manager().rotation_plan().decompose(shift_count));
+  if( steps.empty() ){
+    key_manager().evaluator().rotate_vector_inplace(
+        out.ref(), shift_count, key_manager().glk(), key_manager().pool()
+    );
+    return;
+  }
+  for( const int step : steps ){
+    key_manager().evaluator().rotate_vector_inplace(
+        out.ref(), step, key_manager().glk(), key_manager().pool()
+    );
+  }
 }
   
 template<>
@@ -379,11 +615,15 @@ inline void Operator<ImplSeal>::rotate(Ciphertext<ImplSeal>& out,
     check_ptr(in, "in");
     if( shift_count == 0 ){
       copy(out, in);
+    }else if( !has_rotation_key(shift_count) && !key_manager().rotation_plan().empty() ){
+      copy(out, in);
+      rotate(out, shift_count);
     }else{
-      allocate(out, -1, 0.0);
+      allocate_like(out, in);
       check_ptr(out, "out");
       key_manager().evaluator().rotate_vector(in.cref(), shift_count,
-                                              key_manager().glk(), out.ref());
+                                              key_manager().glk(), out.ref(),
+                                              key_manager().pool());
     }
   }
 }
@@ -414,10 +654,27 @@ inline void Operator<ImplSeal>::rotate_and_sum(Ciphertext<ImplSeal>& out,
             }
         ) & target_slot_id);
 
+  auto signed_step = [&](const int step){
+    return ((step & target_slot_id) == 0 ? step : -step);
+  };
+
   Ciphertext<ImplSeal> tmp;
-  for( const int step : rotate_steps ){
-    rotate(tmp, out, ((step & target_slot_id) == 0 ? step : -step));
+  std::vector<Ciphertext<ImplSeal>> rotated;
+  for( size_t i = 0; i < rotate_steps.size(); ){
+    const int step1 = signed_step(rotate_steps[i]);
+    if( i + 1 < rotate_steps.size() ){
+      // 2つのstepをまとめ，outの分解を3回の回転で共有する
+      const int step2 = signed_step(rotate_steps[i + 1]);
+      if( has_rotation_key(step1) && has_rotation_key(step2) && has_rotation_key(step1 + step2) ){
+        rotate_many(rotated, out, {step1, step2, step1 + step2});
+        for( const auto& ct : rotated ){ add(out, ct); }
+        i += 2;
+        continue;
+      }
+    }
+    rotate(tmp, out, step1);
     add(out, tmp);
+    ++i;
   }
 
   if( require_additional_rotate ){
@@ -71,9 +71,13 @@ inline void Operator<ImplSeal>::add(Plaintext<ImplSeal>& out,
   size_t coeff_modulus_size = coeff_modulus.size();
 
   // CKKS方式のみサポートしている
-  RNSIter out_iter(out.ref().data(), coeff_count);
-  ConstRNSIter in_iter(in.cref().data(), coeff_count);
-  add_poly_coeffmod(out_iter, in_iter, coeff_modulus_size, coeff_modulus, out_iter);
+  uint64_t* out_itr = out.ref().data();
+  const uint64_t* in_itr = in.cref().data();
+  ::util::multi_for_parallel([&](const size_t i){
+    const size_t offset = i * coeff_count;
+    add_poly_coeffmod(ConstCoeffIter(out_itr + offset), ConstCoeffIter(in_itr + offset), coeff_count,
+                      coeff_modulus[i], CoeffIter(out_itr + offset));
+  }, key_manager().num_threads(coeff_modulus_size * coeff_count), coeff_modulus_size);
 }
 
 
@@ -87,9 +91,14 @@ inline void Operator<ImplSeal>::mul(Plaintext<ImplSeal>& out,
   size_t coeff_count = parms.poly_modulus_degree();
   size_t coeff_modulus_size = coeff_modulus.size();
 
-  seal::util::RNSIter out_iter(out.ref().data(), coeff_count);
-  seal::util::ConstRNSIter in_iter(in.cref().data(), coeff_count);
-  dyadic_product_coeffmod(out_iter, in_iter, coeff_modulus_size, coeff_modulus, out_iter);
+  uint64_t* out_itr = out.ref().data();
+  const uint64_t* in_itr = in.cref().data();
+  util::multi_for_parallel([&](const size_t i){
+    const size_t offset = i * coeff_count;
+    seal::util::dyadic_product_coeffmod(seal::util::ConstCoeffIter(out_itr + offset),
+                                        seal::util::ConstCoeffIter(in_itr + offset), coeff_count,
+                                        coeff_modulus[i], seal::util::CoeffIter(out_itr + offset));
+  }, key_manager().num_threads(coeff_modulus_size * coeff_count), coeff_modulus_size);
 
   out.ref().scale() *= in.cref().scale();
     
@@ -100,166 +109,435 @@ inline void Operator<ImplSeal>::mul(Plaintext<ImplSeal>& out,
 }
 
 template<>
-template<class MsgType>
-void Operator<ImplSeal>::mul(Plaintext<ImplSeal>& out,
-                             const RawScalar<MsgType>& in_numerator,
-                             const RawScalar<MsgType>& in_denominator,
-                             const EncodingParams<ImplSeal>& ep) const {
-  check_ptr(out, "out");
+inline void Operator<ImplSeal>::mul_add(Ciphertext<ImplSeal>& out,
+                                        const Ciphertext<ImplSeal>& in1,
+                                        const Plaintext<ImplSeal>& in2,
+                                        const Ciphertext<ImplSeal>& in3) const {
+  check_ptr(in1, "in1", in2, "in2", in3, "in3");
+  const auto parms_id = in1.cref().parms_id();
+  if( in2.cref().parms_id() != parms_id || in3.cref().parms_id() != parms_id ){
+    throw std::invalid_argument("in1, in2 and in3 parameter mismatch");
+  }
+  if( !in1.cref().is_ntt_form() || !in2.cref().is_ntt_form() || !in3.cref().is_ntt_form() ){
+    throw std::invalid_argument("in1, in2 and in3 must be in NTT form");
+  }
 
-  auto context_data_ptr = key_manager().context().get_context_data(out.cref().parms_id());
-  if( !context_data_ptr ){
-    throw std::invalid_argument("parms_id is not valid for encryption parameters");
+  auto &context_data = *key_manager().context().get_context_data(parms_id);
+  auto &coeff_modulus = context_data.parms().coeff_modulus();
+  const size_t coeff_count = context_data.parms().poly_modulus_degree();
+  const size_t coeff_modulus_size = coeff_modulus.size();
+
+  const double scale = in1.scale() * in2.scale();
+  if( !::seal::util::are_close<double>(scale, in3.scale()) ){
+    throw std::invalid_argument("scale mismatch");
+  }
+  if( !seal::is_scale_within_bounds(scale, context_data) ){
+    throw std::invalid_argument("scale out of bounds");
+  }
+
+  const size_t size1 = in1.size();
+  const size_t size3 = in3.size();
+  const size_t size = std::max(size1, size3);
+  if( out.ptr() != in1.ptr() && out.ptr() != in3.ptr() ){
+    allocate_like(out, in1);
+    out.ref().resize(key_manager().context(), parms_id, size);
+    out.ref().is_ntt_form() = true;
+  }else if( out.size() < size ){
+    // その場で更新する場合，既存の成分を保持したまま拡張する
+    out.ref().resize(size);
   }
 
-  const auto& context_data = *context_data_ptr;
-  const auto& parms = context_data.parms();
-  const auto& coeff_modulus = parms.coeff_modulus();
+  // outの拡張により領域が再確保される可能性があるため，拡張後にポインタを取得する
+  const uint64_t* in1_itr = in1.cref().data();
+  const uint64_t* in2_itr = in2.cref().data();
+  const uint64_t* in3_itr = in3.cref().data();
+  uint64_t* out_itr = out.ref().data();
+  const size_t poly_size = coeff_count * coeff_modulus_size;
+  for( size_t k = 0; k < size; ++k ){
+    for( size_t i = 0; i < coeff_modulus_size; ++i ){
+      const size_t offset = k * poly_size + i * coeff_count;
+      const size_t offset2 = i * coeff_count;
+      if( k < size1 && k < size3 ){
+        kernel::multiply_add(out_itr + offset, in1_itr + offset, in2_itr + offset2,
+                             in3_itr + offset, coeff_count, coeff_modulus[i]);
+      }else if( k < size1 ){
+        ::seal::util::dyadic_product_coeffmod(in1_itr + offset, in2_itr + offset2, coeff_count,
+                                              coeff_modulus[i], out_itr + offset);
+      }else if( out_itr != in3_itr ){
+        std::copy_n(in3_itr + offset, coeff_count, out_itr + offset);
+      }
+    }
+  }
+
+  out.ref().scale() = scale;
+}
+
+template<>
+inline void Operator<ImplSeal>::mul_add(Ciphertext<ImplSeal>& out,
+                                        const Ciphertext<ImplSeal>& x,
+                                        const Ciphertext<ImplSeal>& coeff) const {
+  check_ptr(out, "out", x, "x", coeff, "coeff");
+  if( out.ptr() == x.ptr() || out.ptr() == coeff.ptr() ){
+    throw std::invalid_argument("out must not alias x or coeff");
+  }
+  if( x.size() != 2 ){
+    throw std::invalid_argument("x must be a ciphertext of size 2");
+  }
+  const auto parms_id = out.cref().parms_id();
+  if( x.cref().parms_id() != parms_id || coeff.cref().parms_id() != parms_id ){
+    throw std::invalid_argument("out, x and coeff parameter mismatch");
+  }
+  if( !out.cref().is_ntt_form() || !x.cref().is_ntt_form() || !coeff.cref().is_ntt_form() ){
+    throw std::invalid_argument("out, x and coeff must be in NTT form");
+  }
+
+  auto &context_data = *key_manager().context().get_context_data(parms_id);
+  auto &coeff_modulus = context_data.parms().coeff_modulus();
+  const size_t coeff_count = context_data.parms().poly_modulus_degree();
   const size_t coeff_modulus_size = coeff_modulus.size();
-  const size_t coeff_count = parms.poly_modulus_degree();
+  const size_t poly_size = coeff_count * coeff_modulus_size;
+
+  const double scale = out.scale() * x.scale();
+  if( !::seal::util::are_close<double>(scale, coeff.scale()) ){
+    throw std::invalid_argument("scale mismatch");
+  }
+  if( !seal::is_scale_within_bounds(scale, context_data) ){
+    throw std::invalid_argument("scale out of bounds");
+  }
 
-  if( !::seal::util::product_fits_in(coeff_modulus_size, coeff_count) ){
-    throw std::logic_error("invalid parameters");
+  const size_t k = out.size();
+  const size_t coeff_size = coeff.size();
+  out.ref().resize(std::max(k + 1, coeff_size));
+
+  // 各点の成分はtの降順に逐次的に更新するため，limbと点のブロックについて並列化する
+  constexpr size_t block_size = 256;
+  const size_t num_blocks = (coeff_count + block_size - 1) / block_size;
+  uint64_t* out_itr = out.ref().data();
+  const uint64_t* x_itr = x.cref().data();
+  const uint64_t* coeff_itr = coeff.cref().data();
+  const int num_threads = key_manager().num_threads((k + 1) * poly_size);
+#pragma omp parallel num_threads(num_threads) if(num_threads > 1)
+  {
+    std::vector<uint64_t*> o(k + 1);
+    std::vector<const uint64_t*> c(k + 1);
+#pragma omp for collapse(2) schedule(static)
+    for( size_t i = 0; i < coeff_modulus_size; ++i ){
+      for( size_t b = 0; b < num_blocks; ++b ){
+        const size_t offset = i * coeff_count + b * block_size;
+        const size_t len = std::min(block_size, coeff_count - b * block_size);
+        for( size_t t = 0; t <= k; ++t ){
+          o[t] = out_itr + t * poly_size + offset;
+          c[t] = (t < coeff_size ? coeff_itr + t * poly_size + offset : nullptr);
+        }
+        kernel::multiply_accumulate_size2(o.data(), k, x_itr + offset, x_itr + poly_size + offset,
+                                          c.data(), len, coeff_modulus[i]);
+      }
+    }
   }
 
-  if( ep.scale <= 0
-      || (static_cast<int>(log2(ep.scale)) >= context_data.total_coeff_modulus_bit_count()) ){
+  // coeffの成分数がk+1を超える場合，残りの成分はcoeffのまま
+  for( size_t t = k + 1; t < coeff_size; ++t ){
+    std::copy_n(coeff_itr + t * poly_size, poly_size, out_itr + t * poly_size);
+  }
+
+  out.ref().scale() = scale;
+}
+
+template<>
+template<class MsgType>
+void Operator<ImplSeal>::encode(EncodedRationalScalar<ImplSeal>& out,
+                                const RawScalar<MsgType>& in_numerator,
+                                const RawScalar<MsgType>& in_denominator,
+                                const EncodingParams<ImplSeal>& params) const {
+  // 任意のレベルにかけられるよう，最上位レベルの全moduliについて求める
+  const auto& context_data = *key_manager().context().first_context_data();
+  const auto& coeff_modulus = context_data.parms().coeff_modulus();
+  const size_t coeff_modulus_size = coeff_modulus.size();
+
+  if( params.scale <= 0
+      || (static_cast<int>(log2(params.scale)) >= context_data.total_coeff_modulus_bit_count()) ){
     throw std::invalid_argument("scale out of bounds");
   }
 
   auto encode_value = [&](const RawScalar<MsgType>& in){
-    double value = in.cref() * ep.scale;
-    
-    int coeff_bit_count = static_cast<int>(log2(fabs(value))) + 2;
+    double value = in.cref() * params.scale;
+
+    int coeff_bit_count = (value == 0.0 ? 0 : static_cast<int>(log2(fabs(value))) + 2);
     if( coeff_bit_count >= context_data.total_coeff_modulus_bit_count() ){
       throw std::invalid_argument("encoded value is too large");
     }
-    
+
     double coeffd = round(value);
     bool is_negative = std::signbit(coeffd);
     coeffd = fabs(coeffd);
 
-    return std::make_tuple(coeffd, is_negative, coeff_bit_count);
+    return std::make_tuple(coeffd, is_negative);
   };
 
-  auto [coeffd_numerator, is_negative_numerator, coeff_bit_count_numerator] = encode_value(in_numerator);
-  auto [coeffd_denominator, is_negative_denominator, coeff_bit_count_denominator] = encode_value(in_denominator);
-  
-  // CKKS方式のみサポートしている
-  auto eval_mul = [&](auto&& calc_encoded_scalar){
-    ::seal::util::RNSIter out_iter(out.ref().data(), coeff_count);
-    ::seal::util::PtrIter<const ::seal::Modulus*> modulus_iter = coeff_modulus.data();
-    SEAL_ITERATE(::seal::util::iter(out_iter, modulus_iter), coeff_modulus_size, [&](auto I){
-      const ::seal::Modulus& modulus = get<1>(I);
-      auto [encoded_scalar, is_negative] = calc_encoded_scalar(modulus);
-      if( is_negative ){
-        encoded_scalar = ::seal::util::negate_uint_mod(encoded_scalar, modulus);
-      }
-      ::seal::util::multiply_poly_scalar_coeffmod(get<0>(I), coeff_count, encoded_scalar, modulus, get<0>(I));
-    });
+  // 非負の整数値coeffdのmodulusによる剰余
+  // 2^64以上の場合は coeffd = M * 2^e（Mは53bitの仮数）と厳密に分解し，(M mod q) * (2^e mod q)とする
+  auto reduce = [](const double coeffd, const ::seal::Modulus& modulus){
+    if( coeffd < 0x1p64 ){
+      return ::seal::util::barrett_reduce_64(static_cast<uint64_t>(coeffd), modulus);
+    }
+    int exponent = 0;
+    const double fraction = std::frexp(coeffd, &exponent);
+    const uint64_t mantissa = static_cast<uint64_t>(std::ldexp(fraction, 53));
+    const uint64_t power = ::seal::util::exponentiate_uint_mod(2, exponent - 53, modulus);
+    return ::seal::util::multiply_uint_mod(::seal::util::barrett_reduce_64(mantissa, modulus),
+                                           power, modulus);
   };
 
-  if( coeff_bit_count_numerator <= 64 && coeff_bit_count_denominator ){
-    uint64_t coeffu_numerator = static_cast<uint64_t>(fabs(coeffd_numerator));
-    uint64_t coeffu_denominator = static_cast<uint64_t>(fabs(coeffd_denominator));
-    eval_mul([coeffu_numerator, is_negative_numerator, coeffu_denominator, is_negative_denominator](const auto& modulus){
-      uint64_t numerator = ::seal::util::barrett_reduce_64(coeffu_numerator, modulus);
-      uint64_t denominator = ::seal::util::barrett_reduce_64(coeffu_denominator, modulus);
-      seal::util::try_invert_uint_mod(denominator, modulus.value(), denominator);
-      
-      return std::make_tuple(
-          multiply_uint_mod(numerator, denominator, modulus),
-          is_negative_numerator ^ is_negative_denominator
-      );
-    });
-  }else{
-    util::throw_not_implemented_error(__FILE__, __LINE__, __func__);
+  const auto [coeffd_numerator, is_negative_numerator] = encode_value(in_numerator);
+  const auto [coeffd_denominator, is_negative_denominator] = encode_value(in_denominator);
+
+  std::vector<EncodedRationalScalar<ImplSeal>::Operand> operands(coeff_modulus_size);
+  for( size_t i = 0; i < coeff_modulus_size; ++i ){
+    const ::seal::Modulus& modulus = coeff_modulus[i];
+    const uint64_t numerator = reduce(coeffd_numerator, modulus);
+    uint64_t denominator = reduce(coeffd_denominator, modulus);
+    if( !::seal::util::try_invert_uint_mod(denominator, modulus, denominator) ){
+      throw std::invalid_argument("denominator is not invertible");
+    }
+
+    uint64_t encoded_scalar = ::seal::util::multiply_uint_mod(numerator, denominator, modulus);
+    if( is_negative_numerator ^ is_negative_denominator ){
+      encoded_scalar = ::seal::util::negate_uint_mod(encoded_scalar, modulus);
+    }
+    operands[i].set(encoded_scalar, modulus);
   }
 
-  out.scale() *= ep.scale;
-  
+  out = EncodedRationalScalar<ImplSeal>(std::move(operands), params.scale);
 }
 
 template<>
-template<class MsgType>
-void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
-                             const RawScalar<MsgType>& in_numerator,
-                             const RawScalar<MsgType>& in_denominator,
-                             const EncodingParams<ImplSeal>& ep) const {
+inline void Operator<ImplSeal>::mul(Plaintext<ImplSeal>& out,
+                                    const EncodedRationalScalar<ImplSeal>& in) const {
   check_ptr(out, "out");
 
   auto context_data_ptr = key_manager().context().get_context_data(out.cref().parms_id());
   if( !context_data_ptr ){
     throw std::invalid_argument("parms_id is not valid for encryption parameters");
   }
-
-  const auto& context_data = *context_data_ptr;
-  const auto& parms = context_data.parms();
-  const auto& coeff_modulus = parms.coeff_modulus();
+  const auto& coeff_modulus = context_data_ptr->parms().coeff_modulus();
   const size_t coeff_modulus_size = coeff_modulus.size();
-  const size_t coeff_count = parms.poly_modulus_degree();
+  const size_t coeff_count = context_data_ptr->parms().poly_modulus_degree();
+  if( in.num_moduli() < coeff_modulus_size ){
+    throw std::invalid_argument("scalar is not encoded for the level of out");
+  }
+
+  // CKKS方式のみサポートしている
+  uint64_t* out_itr = out.ref().data();
+  util::multi_for_parallel([&](const size_t i){
+    uint64_t* poly = out_itr + i * coeff_count;
+    kernel::multiply_scalar(poly, poly, coeff_count, in.operand(i), coeff_modulus[i]);
+  }, key_manager().num_threads(coeff_modulus_size * coeff_count), coeff_modulus_size);
+
+  out.scale(out.scale() * in.scale());
+}
 
-  if( !::seal::util::product_fits_in(coeff_modulus_size, coeff_count) ){
-    throw std::logic_error("invalid parameters");
+template<>
+inline void Operator<ImplSeal>::mul(Ciphertext<ImplSeal>& out,
+                                    const EncodedRationalScalar<ImplSeal>& in) const {
+  check_ptr(out, "out");
+
+  auto context_data_ptr = key_manager().context().get_context_data(out.cref().parms_id());
+  if( !context_data_ptr ){
+    throw std::invalid_argument("parms_id is not valid for encryption parameters");
+  }
+  const auto& coeff_modulus = context_data_ptr->parms().coeff_modulus();
+  const size_t coeff_modulus_size = coeff_modulus.size();
+  const size_t coeff_count = context_data_ptr->parms().poly_modulus_degree();
+  if( in.num_moduli() < coeff_modulus_size ){
+    throw std::invalid_argument("scalar is not encoded for the level of out");
   }
 
-  if( ep.scale <= 0
-      || (static_cast<int>(log2(ep.scale)) >= context_data.total_coeff_modulus_bit_count()) ){
-    throw std::invalid_argument("scale out of bounds");
+  // (成分, limb)ごとの乗算を独立に実行する
+  const size_t num_polys = out.size();
+  uint64_t* out_itr = out.ref().data();
+  util::multi_for_parallel([&](const size_t k, const size_t i){
+    uint64_t* poly = out_itr + (k * coeff_modulus_size + i) * coeff_count;
+    kernel::multiply_scalar(poly, poly, coeff_count, in.operand(i), coeff_modulus[i]);
+  }, key_manager().num_threads(num_polys * coeff_modulus_size * coeff_count), num_polys, coeff_modulus_size);
+
+  out.scale(out.scale() * in.scale());
+}
+
+template<>
+inline bool Operator<ImplSeal>::has_rotation_key(const int shift_count) const {
+  if( shift_count == 0 || std::abs(shift_count) >= static_cast<int>(num_slots()) ){ return false; }
+  const auto galois_tool = key_manager().context().key_context_data()->galois_tool();
+  return key_manager().glk().has_key(galois_tool->get_elt_from_step(shift_count));
+}
+
+/*
+ * SEALのEvaluator::switch_key_inplace()を，inの第1成分の分解（逆NTT，各modulusへのreduction，NTT）と
+ * 回転ごとの内積・mod downに分けたもの．
+ * Galois自己同型はNTT形式では評価点の置換となるため，分解済みの値を置換してから鍵との内積をとる．
+ * 置換後の分解は，σ(c_1)の分解と各limbの倍数（q_J）の差しかなく，ノイズへの影響は高々2倍である．
+ */
+template<>
+inline void Operator<ImplSeal>::rotate_many(std::vector<Ciphertext<ImplSeal>>& out,
+                                            const Ciphertext<ImplSeal>& in,
+                                            const std::vector<int>& steps) const {
+  check_ptr(in, "in");
+  using namespace std;
+  using namespace seal;
+  using namespace seal::util;
+  if( in.size() != 2 ){
+    throw invalid_argument("encrypted size must be 2");
+  }
+  if( !in.cref().is_ntt_form() ){
+    throw invalid_argument("in must be in NTT form");
   }
 
-  auto encode_value = [&](const RawScalar<MsgType>& in){
-    double value = in.cref() * ep.scale;
-    
-    int coeff_bit_count = static_cast<int>(log2(fabs(value))) + 2;
-    if( coeff_bit_count >= context_data.total_coeff_modulus_bit_count() ){
-      throw std::invalid_argument("encoded value is too large");
-    }
-    
-    double coeffd = round(value);
-    bool is_negative = std::signbit(coeffd);
-    coeffd = fabs(coeffd);
+  out.resize(steps.size());
 
-    return std::make_tuple(coeffd, is_negative, coeff_bit_count);
-  };
+  const auto& glk = key_manager().glk();
+  auto &key_context_data = *key_manager().context().key_context_data();
+  const auto galois_tool = key_context_data.galois_tool();
 
-  auto [coeffd_numerator, is_negative_numerator, coeff_bit_count_numerator] = encode_value(in_numerator);
-  auto [coeffd_denominator, is_negative_denominator, coeff_bit_count_denominator] = encode_value(in_denominator);
-  
-  // CKKS方式のみサポートしている
-  auto eval_mul = [&](auto&& calc_encoded_scalar){
-    ::seal::util::PtrIter<const ::seal::Modulus*> modulus_iter = coeff_modulus.data();
-    SEAL_ITERATE(::seal::util::iter(out.ref()), out.size(), [&](auto J) {
-      SEAL_ITERATE(::seal::util::iter(J, modulus_iter), coeff_modulus_size, [&](auto I){
-        const ::seal::Modulus& modulus = get<1>(I);
-        auto [encoded_scalar, is_negative] = calc_encoded_scalar(modulus);
-        if( is_negative ){
-          encoded_scalar = ::seal::util::negate_uint_mod(encoded_scalar, modulus);
-        }
-        ::seal::util::multiply_poly_scalar_coeffmod(get<0>(I), coeff_count, encoded_scalar, modulus, get<0>(I));
-      });
-    });
+  // 鍵が直接存在する回転のみを分解を共有して計算する
+  vector<size_t> hoisted;
+  vector<size_t> others;
+  for( size_t i = 0; i < steps.size(); ++i ){
+    (has_rotation_key(steps[i]) ? hoisted : others).push_back(i);
+  }
+  ::util::for_parallel([&](const size_t i){
+    rotate(out[others[i]], in, steps[others[i]]);
+  }, others.size());
+  if( hoisted.empty() ){ return; }
+
+  const auto parms_id = in.cref().parms_id();
+  auto &context_data = *key_manager().context().get_context_data(parms_id);
+  const size_t coeff_count = context_data.parms().poly_modulus_degree();
+  const size_t decomp_modulus_size = context_data.parms().coeff_modulus().size();
+  auto &key_modulus = key_context_data.parms().coeff_modulus();
+  const size_t key_modulus_size = key_modulus.size();
+  const size_t rns_modulus_size = decomp_modulus_size + 1;
+  const NTTTables* key_ntt_tables = key_context_data.small_ntt_tables();
+  const auto& modswitch_factors = key_context_data.rns_tool()->inv_q_last_mod_q();
+  auto key_index = [&](const size_t i){ return (i == decomp_modulus_size ? key_modulus_size - 1 : i); };
+
+  // digits[J][I]: c_1の第J limbを第I modulus（I == decomp_modulus_sizeは特殊modulus）に持ち上げたNTT形式の値
+  auto pool = key_manager().pool();
+  const uint64_t* c1 = in.cref().data(1);
+  auto t_target = allocate_uint(decomp_modulus_size * coeff_count, pool);
+  auto digits = allocate_uint(decomp_modulus_size * rns_modulus_size * coeff_count, pool);
+  auto digit = [&](const size_t j, const size_t i){
+    return digits.get() + (j * rns_modulus_size + i) * coeff_count;
   };
 
-  if( coeff_bit_count_numerator <= 64 && coeff_bit_count_denominator ){
-    uint64_t coeffu_numerator = static_cast<uint64_t>(fabs(coeffd_numerator));
-    uint64_t coeffu_denominator = static_cast<uint64_t>(fabs(coeffd_denominator));
-    eval_mul([coeffu_numerator, is_negative_numerator, coeffu_denominator, is_negative_denominator](const auto& modulus){
-      uint64_t numerator = ::seal::util::barrett_reduce_64(coeffu_numerator, modulus);
-      uint64_t denominator = ::seal::util::barrett_reduce_64(coeffu_denominator, modulus);
-      seal::util::try_invert_uint_mod(denominator, modulus.value(), denominator);
-      
-      return std::make_tuple(
-          ::seal::util::multiply_uint_mod(numerator, denominator, modulus),
-          is_negative_numerator ^ is_negative_denominator
-      );
-    });
-  }else{
-    util::throw_not_implemented_error(__FILE__, __LINE__, __func__);
-  }
+  const int num_threads = key_manager().num_threads(decomp_modulus_size * rns_modulus_size * coeff_count);
+  ::util::multi_for_parallel([&](const size_t j){
+    uint64_t* t = t_target.get() + j * coeff_count;
+    copy_n(c1 + j * coeff_count, coeff_count, t);
+    inverse_ntt_negacyclic_harvey(CoeffIter(t), key_ntt_tables[j]);
+  }, num_threads, decomp_modulus_size);
+
+  ::util::multi_for_parallel([&](const size_t j, const size_t i){
+    const size_t k = key_index(i);
+    if( i == j ){
+      // 第J limbはもともとNTT形式で持っている
+      copy_n(c1 + j * coeff_count, coeff_count, digit(j, i));
+      return;
+    }
+    const uint64_t* t = t_target.get() + j * coeff_count;
+    if( key_modulus[j].value() <= key_modulus[k].value() ){
+      copy_n(t, coeff_count, digit(j, i));
+    }else{
+      modulo_poly_coeffs(ConstCoeffIter(t), coeff_count, key_modulus[k], CoeffIter(digit(j, i)));
+    }
+    // [0, 4q)の値を出力する
+    ntt_negacyclic_harvey_lazy(CoeffIter(digit(j, i)), key_ntt_tables[k]);
+  }, num_threads, decomp_modulus_size, rns_modulus_size);
+
+  ::util::for_parallel([&](const size_t h){
+    const size_t index = hoisted[h];
+    const uint32_t galois_elt = galois_tool->get_elt_from_step(steps[index]);
+    const auto& key_vector = glk.data()[GaloisKeys::get_index(galois_elt)];
+    auto& dst = out[index];
+    allocate_like(dst, in);
+    dst.ref().resize(key_manager().context(), parms_id, 2);
+    dst.ref().is_ntt_form() = true;
+    dst.ref().scale() = in.cref().scale();
+    uint64_t* dst_itr = dst.ref().data();
+
+    // 第0成分はσ(c_0)
+    galois_tool->apply_galois_ntt(ConstRNSIter(in.cref().data(0), coeff_count), decomp_modulus_size,
+                                  galois_elt, RNSIter(dst_itr, coeff_count));
+
+    // prod[K][I] = Σ_J σ(digits[J][I]) * key[J][K][I]
+    auto local_pool = key_manager().pool();
+    auto prod = allocate_uint(2 * rns_modulus_size * coeff_count, local_pool);
+    const int inner_threads = key_manager().num_threads(decomp_modulus_size * rns_modulus_size * coeff_count);
+    ::util::multi_for_parallel([&](const size_t i){
+      const size_t k = key_index(i);
+      auto thread_pool = key_manager().pool();
+      auto permuted = allocate_uint(coeff_count, thread_pool);
+      // 128bitの累積値（成分ごとに2 * coeff_count語）
+      auto acc_ptr = allocate_zero_uint(2 * 2 * coeff_count, thread_pool);
+      uint64_t* acc = acc_ptr.get();
+      for( size_t j = 0; j < decomp_modulus_size; ++j ){
+        galois_tool->apply_galois_ntt(ConstCoeffIter(digit(j, i)), galois_elt, CoeffIter(permuted.get()));
+        for( size_t c = 0; c < 2; ++c ){
+          const uint64_t* key = key_vector[j].data().data(c) + k * coeff_count;
+          kernel::multiply_accumulate_lazy(acc + c * 2 * coeff_count, permuted.get(), key, coeff_count);
+          if( (j + 1) % kernel::lazy_accumulation_bound == 0 ){
+            kernel::reduce_accumulator(nullptr, acc + c * 2 * coeff_count, coeff_count, key_modulus[k]);
+          }
+        }
+      }
+      for( size_t c = 0; c < 2; ++c ){
+        kernel::reduce_accumulator(prod.get() + (c * rns_modulus_size + i) * coeff_count,
+                                   acc + c * 2 * coeff_count, coeff_count, key_modulus[k]);
+      }
+    }, inner_threads, rns_modulus_size);
+
+    // 特殊modulusで割って丸め，第K成分に加える
+    const Modulus& qk_modulus = key_modulus[key_modulus_size - 1];
+    const uint64_t qk = qk_modulus.value();
+    const uint64_t qk_half = qk >> 1;
+    for( size_t c = 0; c < 2; ++c ){
+      uint64_t* t_last = prod.get() + (c * rns_modulus_size + decomp_modulus_size) * coeff_count;
+      inverse_ntt_negacyclic_harvey_lazy(CoeffIter(t_last), key_ntt_tables[key_modulus_size - 1]);
+      for( size_t l = 0; l < coeff_count; ++l ){
+        t_last[l] = barrett_reduce_64(t_last[l] + qk_half, qk_modulus);
+      }
 
-  out.scale() *= ep.scale;
+      ::util::multi_for_parallel([&](const size_t j){
+        auto t_ntt = allocate_uint(coeff_count, key_manager().pool());
+        const Modulus& qi_modulus = key_modulus[j];
+        const uint64_t qi = qi_modulus.value();
+        if( qk > qi ){
+          modulo_poly_coeffs(ConstCoeffIter(t_last), coeff_count, qi_modulus, CoeffIter(t_ntt.get()));
+        }else{
+          copy_n(t_last, coeff_count, t_ntt.get());
+        }
 
+        // [0, 2qi)
+        const uint64_t fix = qi - barrett_reduce_64(qk_half, qi_modulus);
+        for( size_t l = 0; l < coeff_count; ++l ){ t_ntt[l] += fix; }
+
+        // [0, 4qi)
+        ntt_negacyclic_harvey_lazy(CoeffIter(t_ntt.get()), key_ntt_tables[j]);
+#if SEAL_USER_MOD_BIT_COUNT_MAX > 60
+        uint64_t qi_lazy = qi << 1;
+        for( size_t l = 0; l < coeff_count; ++l ){ t_ntt[l] -= (t_ntt[l] >= qi_lazy ? qi_lazy : 0); }
+#else
+        const uint64_t qi_lazy = qi << 2;
+#endif
+
+        // qk^{-1} * ((ct mod qi) - (ct mod qk)) mod qi
+        const uint64_t* p = prod.get() + (c * rns_modulus_size + j) * coeff_count;
+        uint64_t* d = dst_itr + (c * decomp_modulus_size + j) * coeff_count;
+        for( size_t l = 0; l < coeff_count; ++l ){
+          const uint64_t r = multiply_uint_mod(p[l] + qi_lazy - t_ntt[l], modswitch_factors[j], qi_modulus);
+          d[l] = (c == 0 ? add_uint_mod(d[l], r, qi_modulus) : r);
+        }
+      }, inner_threads, decomp_modulus_size);
+    }
+  }, hoisted.size());
 }
 
 }  // namespace he_wrapper_tmpl
@@ -20,22 +20,41 @@ public:
   
   auto& ptr() noexcept { return data_; }
   const auto& ptr() const noexcept { return data_; }
-  auto& ref(){ return *data_; }
-  const auto& ref() const { return *data_; }
+  /**
+   * 書き込み用の参照．
+   * 領域が他の平文と共有されている場合（copy-on-write）は，先に複製して共有を解く．
+   * 読み出しのみの場合はcref()を用いる．
+   */
+  auto& ref(){
+    detach();
+    return *data_;
+  }
+  const auto& ref() const noexcept { return *data_; }
   const auto& cref() const { return *data_; }
   [[deprecated]]
   int level() const noexcept { return cref().coeff_count() / poly_degree_ - 1; }
   int num_moduli() const noexcept { return cref().coeff_count() / poly_degree_; }
-  void scale(const double s){ ref().scale() = s; }
-  double& scale() noexcept { return ref().scale(); }
+  /// scaleの読み出しは共有を解かない（書き込みはscale(s)で行う）
   double scale() const noexcept { return cref().scale(); }
+  void scale(const double s){ ref().scale() = s; }
   
-  /// @note 現状，levelは反映されるようには実装していない
+  /**
+   * km.data_pool()から領域を確保する．
+   * levelが有効な場合は，そのレベルの平文を再確保なしに格納できる容量を確保する．
+   * levelが負の場合は容量を確保しない（最初の演算で確保される）．
+   * 他の平文と共有している領域は出力で上書きされるため，複製せずに手放して新たに確保する．
+   */
   void allocate(const KeyManager<ImplSeal>& km, const int level, const double scale){
+    release_shared();
     if( data_ == nullptr ){
-      data_ = std::make_shared<::seal::Plaintext>();
+      if( const auto context_data = km.context_data(level) ){
+        const size_t capacity = km.poly_degree() * context_data->parms().coeff_modulus().size();
+        data_ = std::make_shared<::seal::Plaintext>(capacity, 0, km.data_pool());
+      }else{
+        data_ = std::make_shared<::seal::Plaintext>(km.data_pool());
+      }
     }
-    this->scale() = scale;
+    data_->scale() = scale;
   }
 
   void allocate(const KeyManager<ImplSeal>& km){
@@ -72,6 +91,22 @@ public:
     data_ = nullptr;
   }
 
+  auto data(){ return ref().data(); }
+  auto data() const noexcept { return cref().data(); }
+
+  /// ep.parms_idのmoduliで多項式1個分の領域を確保する（内容は上書きされる前提とする）
+  void resize(const KeyManager<ImplSeal>& km, const EncodingParams<ImplSeal>& ep){
+    const auto& moduli = km.context().get_context_data(ep.parms_id)->parms().coeff_modulus();
+    release_shared();
+    if( data_ == nullptr ){
+      data_ = std::make_shared<DataType>(km.data_pool());
+    }
+    data_->scale() = ep.scale;
+    data_->parms_id() = seal::parms_id_zero;
+    data_->resize(km.poly_degree() * moduli.size());
+    data_->parms_id() = ep.parms_id;
+  }
+
   void set_data(std::vector<uint64_t>&& vec, const KeyManager<ImplSeal>& km,
                 const EncodingParams<ImplSeal>& ep){
     const auto& moduli = km.context().get_context_data(ep.parms_id)->parms().coeff_modulus();
@@ -79,15 +114,25 @@ public:
     if( t != vec.size() ){
       throw std::invalid_argument("Invalid size of vector for Ciphertext.");
     }
-    scale() = ep.scale;
-    data_->parms_id() = seal::parms_id_zero;
-    data_->resize(vec.size());
-    data_->parms_id() = ep.parms_id;
+    resize(km, ep);
     std::copy(vec.begin(), vec.end(), data_->data());
   }
 
   
+  /// 領域が他の平文と共有されている場合は複製し，この平文が専有するようにする
+  void detach(){
+    if( data_ == nullptr || data_.use_count() == 1 ){ return; }
+    auto copied = std::make_shared<DataType>(data_->pool());
+    *copied = *data_;
+    data_ = std::move(copied);
+  }
+
 private:
+  /// 領域が他の平文と共有されている場合は，複製せずに手放す（直後に上書きする場合に用いる）
+  void release_shared() noexcept {
+    if( data_ != nullptr && data_.use_count() > 1 ){ data_ = nullptr; }
+  }
+
   int poly_degree_ = 0;
   
   std::shared_ptr<DataType> data_ = nullptr;
@@ -17,6 +17,7 @@ struct ImplSeal{
 
   using EncodingParams = ::he_wrapper_tmpl::EncodingParams<ImplSeal>;
   using EncodingParamsList = std::vector<EncodingParams>;
+  using EncodedRationalScalar = ::he_wrapper_tmpl::EncodedRationalScalar<ImplSeal>;
   using Operator = ::he_wrapper_tmpl::Operator<ImplSeal>;
   
 };
@@ -26,6 +27,7 @@ struct ImplSeal{
 
 #include"he_wrapper_tmpl/seal/key_manager.hpp"
 #include"he_wrapper_tmpl/seal/encoding_params.hpp"
+#include"he_wrapper_tmpl/seal/encoded_rational_scalar.hpp"
 #include"he_wrapper_tmpl/seal/plaintext.hpp"
 #include"he_wrapper_tmpl/seal/ciphertext.hpp"
 #include"he_wrapper_tmpl/seal/operator.hpp"
@@ -1,6 +1,7 @@
 #pragma once
 
 #include<concepts>
+#include<exception>
 
 namespace util{
 template<class Func, class ...Args>
@@ -30,18 +31,84 @@ __attribute__((always_inline)) inline void multi_for(Func&& func, const Ts... si
 }
 
 
+/**
+ * [0, n)の各iについてfunc(i)をOpenMPで並列に実行する．
+ * funcが例外を投げた場合は，並列領域を抜けた後に最初の例外を再送出する．
+ */
+template<class Func, std::integral T>
+inline void for_parallel(Func&& func, const T n){
+  std::exception_ptr error = nullptr;
+#pragma omp parallel for schedule(dynamic) if(n > 1)
+  for( T i = 0; i < n; ++i ){
+    try{
+      func(i);
+    }catch(...){
+#pragma omp critical(util_for_parallel)
+      if( !error ){ error = std::current_exception(); }
+    }
+  }
+  if( error ){ std::rethrow_exception(error); }
+}
+
+
+namespace detail{
+/// func(indices...)を呼び出し，例外が投げられた場合は最初の1つをerrorに保存する（並列領域内用）
+template<class Func, std::integral ...I>
+__attribute__((always_inline)) inline void invoke_capturing(std::exception_ptr& error, Func& func,
+                                                            I... indices){
+  try{
+    func(indices...);
+  }catch(...){
+#pragma omp critical(util_multi_for_parallel)
+    if( !error ){ error = std::current_exception(); }
+  }
+}
+}  // namespace detail
+
+/**
+ * n1 × n2 × ...の各添字についてfuncをOpenMPで並列に実行する（num_threads > 1の場合）．
+ * funcが例外を投げた場合は，並列領域を抜けた後に最初の例外を再送出する．
+ */
+template<class Func, std::integral T1>
+__attribute__((always_inline)) inline void multi_for_parallel(
+    Func&& func, const int num_threads, const T1 n1
+){
+  std::exception_ptr error = nullptr;
+#pragma omp parallel for if(num_threads>1) num_threads(num_threads)
+  for( T1 i1 = 0; i1 < n1; ++i1 ){
+    detail::invoke_capturing(error, func, i1);
+  }
+  if( error ){ std::rethrow_exception(error); }
+}
+
+template<class Func, std::integral T1, std::integral T2>
+__attribute__((always_inline)) inline void multi_for_parallel(
+    Func&& func, const int num_threads, const T1 n1, const T2 n2
+){
+  std::exception_ptr error = nullptr;
+#pragma omp parallel for collapse(2) if(num_threads>1) num_threads(num_threads)
+  for( T1 i1 = 0; i1 < n1; ++i1 ){
+    for( T2 i2 = 0; i2 < n2; ++i2 ){
+      detail::invoke_capturing(error, func, i1, i2);
+    }
+  }
+  if( error ){ std::rethrow_exception(error); }
+}
+
 template<class Func, std::integral T1, std::integral T2, std::integral T3>
 __attribute__((always_inline)) inline void multi_for_parallel(
     Func&& func, const int num_threads, const T1 n1, const T2 n2, const T3 n3
 ){
+  std::exception_ptr error = nullptr;
 #pragma omp parallel for collapse(3) if(num_threads>1) num_threads(num_threads)
   for( T1 i1 = 0; i1 < n1; ++i1 ){
     for( T2 i2 = 0; i2 < n2; ++i2 ){
       for( T3 i3 = 0; i3 < n3; ++i3 ){
-        func(i1, i2, i3);
+        detail::invoke_capturing(error, func, i1, i2, i3);
       }
     }
   }
+  if( error ){ std::rethrow_exception(error); }
 }
 
 template<class Func, std::integral T1, std::integral T2,
@@ -50,16 +117,18 @@ __attribute__((always_inline)) inline void multi_for_parallel(
     Func&& func, const int num_threads,
     const T1 n1, const T2 n2, const T3 n3, const T4 n4
 ){
+  std::exception_ptr error = nullptr;
 #pragma omp parallel for collapse(4) if(num_threads>1) num_threads(num_threads)
   for( T1 i1 = 0; i1 < n1; ++i1 ){
     for( T2 i2 = 0; i2 < n2; ++i2 ){
       for( T3 i3 = 0; i3 < n3; ++i3 ){
         for( T4 i4 = 0; i4 < n4; ++i4 ){
-          func(i1, i2, i3, i4);
+          detail::invoke_capturing(error, func, i1, i2, i3, i4);
         }
       }
     }
   }
+  if( error ){ std::rethrow_exception(error); }
 }
 
 template<class Func, std::integral T1, std::integral T2,
@@ -68,18 +137,20 @@ __attribute__((always_inline)) inline void multi_for_parallel(
     Func&& func, const int num_threads,
     const T1 n1, const T2 n2, const T3 n3, const T4 n4, const T5 n5
 ){
+  std::exception_ptr error = nullptr;
 #pragma omp parallel for collapse(5) if(num_threads>1) num_threads(num_threads)
   for( T1 i1 = 0; i1 < n1; ++i1 ){
     for( T2 i2 = 0; i2 < n2; ++i2 ){
       for( T3 i3 = 0; i3 < n3; ++i3 ){
         for( T4 i4 = 0; i4 < n4; ++i4 ){
           for( T4 i5 = 0; i5 < n5; ++i5 ){
-            func(i1, i2, i3, i4, i5);
+            detail::invoke_capturing(error, func, i1, i2, i3, i4, i5);
           }
         }
       }
     }
   }
+  if( error ){ std::rethrow_exception(error); }
 }
 
 
@@ -0,0 +1,60 @@
+#pragma once
+
+#include<array>
+#include<cstdint>
+
+namespace util{
+/**
+ * Counter-based PRNG (Philox4x32-10, Salmon et al., SC'11).
+ *
+ * 同じ(counter, key)に対して常に同じ出力を返すため，各スレッドが担当する
+ * counterの範囲さえ決まっていれば，スレッド数によらず出力が一意に定まる．
+ */
+class Philox4x32{
+public:
+  using Counter = std::array<uint32_t, 4>;
+  using Key = std::array<uint32_t, 2>;
+
+  static constexpr Key make_key(const uint64_t seed) noexcept {
+    return {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+  }
+
+  static constexpr Counter make_counter(const uint64_t index, const uint64_t stream) noexcept {
+    return {static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32),
+            static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)};
+  }
+
+  static constexpr Counter generate(Counter ctr, Key key) noexcept {
+    for( int r = 0; r < num_rounds; ++r ){
+      if( r > 0 ){
+        key[0] += weyl0;
+        key[1] += weyl1;
+      }
+      const uint64_t p0 = static_cast<uint64_t>(mul0) * ctr[0];
+      const uint64_t p1 = static_cast<uint64_t>(mul1) * ctr[2];
+      ctr = {static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0],
+             static_cast<uint32_t>(p1),
+             static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1],
+             static_cast<uint32_t>(p0)};
+    }
+    return ctr;
+  }
+
+  /// 1つのcounterから64bit乱数を2つ生成する
+  static constexpr std::array<uint64_t, 2> generate64(const Counter& ctr, const Key& key) noexcept {
+    const auto r = generate(ctr, key);
+    return {(static_cast<uint64_t>(r[1]) << 32) | r[0],
+            (static_cast<uint64_t>(r[3]) << 32) | r[2]};
+  }
+
+private:
+  static constexpr int num_rounds = 10;
+  static constexpr uint32_t mul0 = 0xD2511F53;
+  static constexpr uint32_t mul1 = 0xCD9E8D57;
+  static constexpr uint32_t weyl0 = 0x9E3779B9;
+  static constexpr uint32_t weyl1 = 0xBB67AE85;
+
+};
+
+
+}  // namespace util
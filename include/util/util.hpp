@@ -2,6 +2,7 @@
 
 #include"util/error.hpp"
 #include"util/for_loop.hpp"
+#include"util/philox.hpp"
 #include"util/process_monitor.hpp"
 #include"util/stream.hpp"
 #include"util/string.hpp"